@@ -1,216 +1,4428 @@
 #include <iostream>
 #include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <sstream>
 #include <algorithm>
 #include <iomanip>
 #include <cctype>
+#include <cstdlib>
 #include <functional>
+#include <set>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <deque>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <numeric>
+#include <limits>
+#include <cstdint>
+#include <type_traits>
+#include <string_view>
+#include <charconv>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Index of the lowest set bit; x must be non-zero
+inline int lowestSetBit(std::uint32_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// Index of the highest set bit, i.e. floor(log2(x)); x must be non-zero
+inline int highestSetBit(std::uint32_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return static_cast<int>(index);
+#else
+    return 31 - __builtin_clz(x);
+#endif
+}
+
+inline int lowestSetBit64(std::uint64_t x) {
+    std::uint32_t low = static_cast<std::uint32_t>(x);
+    return low ? lowestSetBit(low) : 32 + lowestSetBit(static_cast<std::uint32_t>(x >> 32));
+}
+
+inline int highestSetBit64(std::uint64_t x) {
+    std::uint32_t high = static_cast<std::uint32_t>(x >> 32);
+    return high ? 32 + highestSetBit(high) : highestSetBit(static_cast<std::uint32_t>(x));
+}
+
+// Log-linear latency histogram in the style of HdrHistogram: values below 32 get their own
+// bucket and every higher power of two is split into 32 buckets, so any recorded value is
+// reported within about 3% of its true size. Values are clamped below 2^40.
+class LatencyHistogram {
+private:
+    static constexpr int kSubBits = 5;
+    static constexpr int kMaxBits = 40;
+    std::array<std::uint64_t, (kMaxBits - kSubBits + 1) << kSubBits> counts{};
+    std::uint64_t total = 0;
+    std::uint64_t sum = 0;
+
+    static size_t bucketOf(std::uint64_t value) {
+        value = std::min<std::uint64_t>(value, (std::uint64_t(1) << kMaxBits) - 1);
+        if (value < (1u << kSubBits)) return static_cast<size_t>(value);
+        int shift = highestSetBit64(value) - kSubBits;
+        return (static_cast<size_t>(shift + 1) << kSubBits) + static_cast<size_t>((value >> shift) - (1u << kSubBits));
+    }
+
+    // Largest value that lands in `bucket`
+    static std::uint64_t upperValueOf(size_t bucket) {
+        size_t group = bucket >> kSubBits;
+        std::uint64_t sub = bucket & ((1u << kSubBits) - 1);
+        if (group == 0) return sub;
+        return (((1u << kSubBits) + sub + 1) << (group - 1)) - 1;
+    }
+
+public:
+    // Records the nanoseconds between construction and destruction
+    class ScopedTimer {
+    private:
+        LatencyHistogram& histogram;
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    public:
+        explicit ScopedTimer(LatencyHistogram& h) : histogram(h) {}
+        ~ScopedTimer() {
+            histogram.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - started).count()));
+        }
+    };
+
+    void record(std::uint64_t value) {
+        ++counts[bucketOf(value)];
+        ++total;
+        sum += value;
+    }
+
+    std::uint64_t count() const {
+        return total;
+    }
+
+    std::uint64_t totalValue() const {
+        return sum;
+    }
+
+    std::uint64_t percentile(double fraction) const {
+        std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(fraction * total));
+        std::uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+            seen += counts[bucket];
+            if (seen >= rank && seen > 0) return upperValueOf(bucket);
+        }
+        return 0;
+    }
+};
+
+// Hot-path instrumentation, compiled in with -DALLOCATOR_INSTRUMENT and absent otherwise
+#ifdef ALLOCATOR_INSTRUMENT
+#define ALLOCATOR_TIME_SCOPE(histogram) LatencyHistogram::ScopedTimer scopeTimer(histogram)
+#define ALLOCATOR_COUNT_SCANNED(blocks) (scannedBlocks += (blocks))
+#else
+#define ALLOCATOR_TIME_SCOPE(histogram) ((void)0)
+#define ALLOCATOR_COUNT_SCANNED(blocks) ((void)0)
+#endif
+
+using ProcessHandle = std::uint32_t;
+
+// Handle stored in blocks that no process owns
+constexpr ProcessHandle kFreeProcess = 0;
+
+// Addresses [start, end] of one block. Address is the integer type used for addresses and
+// sizes throughout an allocator: int keeps a block in 12 bytes on small heaps, std::int64_t
+// reaches heaps beyond 2 GiB.
+template <typename Address>
+class BasicMemoryBlock {
+public:
+    Address start, end;
+    ProcessHandle process;
+
+    BasicMemoryBlock() = default;
+    BasicMemoryBlock(Address s, Address e, ProcessHandle p = kFreeProcess) : start(s), end(e), process(p) {}
+
+    Address size() const {
+        return end - start + 1;
+    }
+
+    bool isFree() const {
+        return process == kFreeProcess;
+    }
+};
+
+using MemoryBlock = BasicMemoryBlock<int>;
+using MemoryBlock64 = BasicMemoryBlock<std::int64_t>;
+
+static_assert(std::is_trivial<MemoryBlock>::value && std::is_standard_layout<MemoryBlock>::value,
+              "MemoryBlock must stay a POD");
+static_assert(sizeof(MemoryBlock) == 12, "MemoryBlock should pack into 12 bytes");
+static_assert(std::is_trivial<MemoryBlock64>::value && sizeof(MemoryBlock64) == 24, "MemoryBlock64 should be 24 bytes");
+
+// Interns process names into 32-bit handles; the empty name maps to kFreeProcess
+class ProcessTable {
+private:
+    std::unordered_map<std::string, ProcessHandle> ids;
+    std::vector<std::string> names;
+
+public:
+    ProcessTable() : names(1) {
+        ids.emplace("", kFreeProcess);
+    }
+
+    ProcessHandle intern(const std::string& name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+
+        ProcessHandle handle = static_cast<ProcessHandle>(names.size());
+        names.push_back(name);
+        ids.emplace(name, handle);
+        return handle;
+    }
+
+    // kFreeProcess when the name has never been interned
+    ProcessHandle find(const std::string& name) const {
+        auto it = ids.find(name);
+        return it == ids.end() ? kFreeProcess : it->second;
+    }
+
+    const std::string& name(ProcessHandle handle) const {
+        return names[handle];
+    }
+
+    // Every interned name, indexed by handle
+    const std::vector<std::string>& all() const {
+        return names;
+    }
+};
+
+// Immutable, refcounted view of a block map for readers that must not take the allocation
+// lock. Blocks are grouped into chunks by start address, and a new snapshot shares every
+// chunk that has not changed since the previous one.
+template <typename Address>
+struct BasicHeapSnapshot {
+    using Block = BasicMemoryBlock<Address>;
+
+    struct Chunk {
+        std::vector<Block> blocks;
+        long long usedUnits = 0;
+        long long freeUnits = 0;
+    };
+
+    std::uint64_t version = 0;
+    long long usedUnits = 0;
+    long long freeUnits = 0;
+    std::vector<std::shared_ptr<const Chunk>> chunks;
+    std::shared_ptr<const std::vector<std::string>> processNames;
+
+    template <typename Visitor>
+    void forEachBlock(Visitor visit) const {
+        for (const auto& chunk : chunks)
+            for (const Block& block : chunk->blocks) visit(block);
+    }
+
+    // Same layout as printStatus, with addresses offset by `base`
+    void print(Address base = 0) const {
+        forEachBlock([&](const Block& block) {
+            std::string status = block.isFree() ? "Unused" : "Process " + (*processNames)[block.process];
+            std::cout << "Addresses [" << base + block.start << ":" << base + block.end << "] "
+                      << status << " | Size: " << block.size() << "\n";
+        });
+    }
+};
+
+using HeapSnapshot = BasicHeapSnapshot<int>;
+
+// Free blocks in address order, held in a treap whose nodes also cache the largest free size
+// in their subtree. The largest hole is read off the root, and first-fit descends straight to
+// the lowest-address hole that fits, skipping every subtree whose cached maximum is too small.
+template <typename Address>
+class FreeSpaceTree {
+private:
+    static constexpr int kNil = -1;
+
+    struct Node {
+        Address start;
+        Address size;
+        Address maxSize;
+        std::uint32_t priority;
+        int left;
+        int right;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> unusedNodes;
+    int root = kNil;
+    std::uint32_t seed = 0x9E3779B9u;
+
+    std::uint32_t nextPriority() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    Address maxOf(int node) const {
+        return node == kNil ? 0 : nodes[node].maxSize;
+    }
+
+    void update(int node) {
+        Node& n = nodes[node];
+        n.maxSize = std::max(n.size, std::max(maxOf(n.left), maxOf(n.right)));
+    }
+
+    // Splits `node` into the keys below `start` and the rest
+    void split(int node, Address start, int& below, int& rest) {
+        if (node == kNil) {
+            below = rest = kNil;
+        } else if (nodes[node].start < start) {
+            split(nodes[node].right, start, nodes[node].right, rest);
+            below = node;
+            update(node);
+        } else {
+            split(nodes[node].left, start, below, nodes[node].left);
+            rest = node;
+            update(node);
+        }
+    }
+
+    // Every key in `low` must precede every key in `high`
+    int merge(int low, int high) {
+        if (low == kNil) return high;
+        if (high == kNil) return low;
+        if (nodes[low].priority > nodes[high].priority) {
+            nodes[low].right = merge(nodes[low].right, high);
+            update(low);
+            return low;
+        }
+        nodes[high].left = merge(low, nodes[high].left);
+        update(high);
+        return high;
+    }
+
+    int firstFit(int node, Address size, Address from) const {
+        if (node == kNil || nodes[node].maxSize < size) return kNil;
+        const Node& n = nodes[node];
+        if (n.start < from) return firstFit(n.right, size, from);
+
+        int found = firstFit(n.left, size, from);
+        if (found != kNil) return found;
+        if (n.size >= size) return node;
+        return firstFit(n.right, size, from);
+    }
+
+public:
+    void insert(Address start, Address size) {
+        int node;
+        if (unusedNodes.empty()) {
+            node = static_cast<int>(nodes.size());
+            nodes.emplace_back();
+        } else {
+            node = unusedNodes.back();
+            unusedNodes.pop_back();
+        }
+        nodes[node] = {start, size, size, nextPriority(), kNil, kNil};
+
+        int below, rest;
+        split(root, start, below, rest);
+        root = merge(merge(below, node), rest);
+    }
+
+    void erase(Address start) {
+        int below, rest, match;
+        split(root, start, below, rest);
+        split(rest, start + 1, match, rest);
+        if (match != kNil) unusedNodes.push_back(match);
+        root = merge(below, rest);
+    }
+
+    void clear() {
+        nodes.clear();
+        unusedNodes.clear();
+        root = kNil;
+    }
+
+    // Replaces the contents with (start, size) holes given in ascending start order, in linear
+    // time: each node is hung off the right spine, which is kept as a stack
+    void assignSorted(const std::vector<std::pair<Address, Address>>& holes) {
+        clear();
+        nodes.reserve(holes.size());
+        std::vector<int> spine;
+        for (const auto& hole : holes) {
+            int node = static_cast<int>(nodes.size());
+            nodes.push_back({hole.first, hole.second, hole.second, nextPriority(), kNil, kNil});
+            int below = kNil;
+            while (!spine.empty() && nodes[spine.back()].priority < nodes[node].priority) {
+                below = spine.back();
+                spine.pop_back();
+                update(below);
+            }
+            nodes[node].left = below;
+            if (!spine.empty()) nodes[spine.back()].right = node;
+            spine.push_back(node);
+        }
+        for (auto it = spine.rbegin(); it != spine.rend(); ++it) update(*it);
+        root = spine.empty() ? kNil : spine.front();
+    }
+
+    Address largest() const {
+        return maxOf(root);
+    }
+
+    // Start of the lowest-address free block at or after `from` with at least `size` units,
+    // or -1 if there is none
+    Address firstFit(Address size, Address from = std::numeric_limits<Address>::min()) const {
+        int node = firstFit(root, size, from);
+        return node == kNil ? -1 : nodes[node].start;
+    }
+};
+
+// Operations the driver needs from an allocation engine
+class AllocatorEngine {
+public:
+    virtual ~AllocatorEngine() = default;
+
+    virtual bool processRequest(const std::string& process, int size, char strategy) = 0;
+    virtual bool release(const std::string& process) = 0;
+    virtual void compact() = 0;
+    virtual void printStatus() const = 0;
+};
+
+template <typename Address>
+class BasicMemoryAllocator : public AllocatorEngine {
+public:
+    using Block = BasicMemoryBlock<Address>;
+    using Snapshot = BasicHeapSnapshot<Address>;
+
+    // A block moved by compaction, so callers can fix up references to it
+    struct Relocation {
+        ProcessHandle process;
+        Address oldStart;
+        Address newStart;
+        Address size;
+    };
+
+    // One power-of-two size class per address bit
+    static constexpr int kSizeClasses = static_cast<int>(8 * sizeof(Address));
+
+    // Occupancy counters, all maintained incrementally so stats() never walks the blocks
+    struct Stats {
+        long long usedUnits = 0;
+        long long freeUnits = 0;
+        size_t usedBlocks = 0;
+        size_t freeBlocks = 0;
+        Address largestFree = 0;
+        double externalFragmentation = 0;  // 1 - largest free block / free units
+        long long splits = 0;
+        long long merges = 0;
+        long long compactions = 0;
+        long long blocksRelocated = 0;
+        long long mergesAvoided = 0;  // by exact-size reuse while coalescing is deferred
+        // Free blocks and units per power-of-two size class, as in CLASSES
+        std::array<size_t, kSizeClasses> freeBlocksByClass{};
+        std::array<long long, kSizeClasses> freeUnitsByClass{};
+    };
+
+    // What to do when no single hole fits a request
+    enum class CompactionPolicy {
+        Never,     // fail the request
+        OnDemand   // if total free space suffices, run the cheapest compaction and retry
+    };
+
+    // One operation of a batch passed to processRequests
+    struct Request {
+        enum Kind { Allocate, Release } kind;
+        ProcessHandle process;
+        Address size;
+        char strategy;
+        Address alignment = 1;
+    };
+
+    // Compaction triggered by the last processRequest
+    struct CompactionReport {
+        bool compacted = false;
+        int blocksMoved = 0;
+        long long unitsMoved = 0;
+    };
+
+private:
+    Address maxMemory;
+    // Blocks keyed by start address, so splits and merges happen in place without re-sorting
+    std::map<Address, Block> blocks;
+    using BlockIter = typename std::map<Address, Block>::iterator;
+
+    BlockIter insertBlock(BlockIter hint, Address start, Address end, ProcessHandle process = kFreeProcess) {
+        return blocks.emplace_hint(hint, start, Block(start, end, process));
+    }
+
+    // Free holes ordered by (size, start): best-fit is a lower_bound, worst-fit the last size
+    std::set<std::pair<Address, Address>> freeBySize;
+    // The same holes by address, for first-fit, next-fit and the largest hole
+    FreeSpaceTree<Address> freeByAddress;
+
+    // Segregated free lists: class k holds the starts of the free blocks sized [2^k, 2^(k+1)).
+    // sizeClassSlot records each start's position so removal is a swap with the last entry.
+    std::vector<Address> sizeClassFree[kSizeClasses];
+    std::unordered_map<Address, size_t> sizeClassSlot;
+    long long sizeClassUnits[kSizeClasses] = {};
+    std::uint64_t nonEmptyClasses = 0;
+    long long totalFreeUnits = 0;
+    long long splitCount = 0;
+    long long mergeCount = 0;
+    long long compactionCount = 0;
+    long long relocatedCount = 0;
+
+    static int sizeClassOf(Address size) {
+        return highestSetBit64(static_cast<std::uint64_t>(size));
+    }
+
+    void indexFreeBlock(const Block& block) {
+        markDirty(block.start);
+        freeBySize.emplace(block.size(), block.start);
+        freeByAddress.insert(block.start, block.size());
+
+        int cls = sizeClassOf(block.size());
+        sizeClassSlot[block.start] = sizeClassFree[cls].size();
+        sizeClassFree[cls].push_back(block.start);
+        sizeClassUnits[cls] += block.size();
+        totalFreeUnits += block.size();
+        nonEmptyClasses |= std::uint64_t(1) << cls;
+    }
+
+    void unindexFreeBlock(const Block& block) {
+        markDirty(block.start);
+        freeBySize.erase({block.size(), block.start});
+        freeByAddress.erase(block.start);
+
+        int cls = sizeClassOf(block.size());
+        std::vector<Address>& list = sizeClassFree[cls];
+        auto slot = sizeClassSlot.find(block.start);
+        list[slot->second] = list.back();
+        sizeClassSlot[list.back()] = slot->second;
+        list.pop_back();
+        sizeClassSlot.erase(block.start);
+        sizeClassUnits[cls] -= block.size();
+        totalFreeUnits -= block.size();
+        if (list.empty()) nonEmptyClasses &= ~(std::uint64_t(1) << cls);
+    }
+
+    void clearFreeIndex() {
+        freeBySize.clear();
+        freeByAddress.clear();
+        for (auto& list : sizeClassFree) list.clear();
+        sizeClassSlot.clear();
+        std::fill(std::begin(sizeClassUnits), std::end(sizeClassUnits), 0);
+        totalFreeUnits = 0;
+        nonEmptyClasses = 0;
+    }
+
+    // Start addresses of the blocks each process owns, so release never scans the whole map
+    std::unordered_map<ProcessHandle, std::vector<Address>> blocksByProcess;
+    ProcessTable processes;
+
+    // Address where the last next-fit search stopped; an address rather than an iterator,
+    // so it survives merges, releases and compaction
+    Address nextFitCursor = 0;
+
+    // Incremental compaction: everything below the frontier is packed, and each step slides
+    // the allocated block after the first hole down into it
+    Address compactionFrontier = 0;
+    int backgroundCompactionBudget = 0;
+    CompactionPolicy compactionPolicy = CompactionPolicy::Never;
+    CompactionReport lastCompaction;
+
+    // While set, released blocks are not merged with their neighbours straight away; their
+    // address ranges wait in pendingCoalesce until coalescePending() runs
+    bool deferCoalescing = false;
+    std::vector<std::pair<Address, Address>> pendingCoalesce;
+
+    // Deferred-coalescing mode (setCoalesceThreshold): released blocks stay unmerged until
+    // coalesceThreshold of them wait or an allocation misses, and meanwhile sit in quickReuse
+    // by exact size so a request of that size takes one back without splitting or merging
+    size_t coalesceThreshold = 0;
+    std::unordered_map<Address, std::vector<Address>> quickReuse;
+    long long mergesAvoided = 0;
+
+    // Snapshot chunks changed since the last publishSnapshot(); every block map change passes
+    // through the free index hooks, which mark the chunk of the block's start
+    Address snapshotChunkSpan = 0;
+    std::vector<char> chunkDirty;
+    std::vector<size_t> dirtyChunks;
+    std::shared_ptr<const Snapshot> published;
+
+    void markDirty(Address address) {
+        if (snapshotChunkSpan == 0) return;
+        size_t chunk = static_cast<size_t>(address / snapshotChunkSpan);
+        if (!chunkDirty[chunk]) {
+            chunkDirty[chunk] = 1;
+            dirtyChunks.push_back(chunk);
+        }
+    }
+
+    void markAllDirty() {
+        for (size_t chunk = 0; chunk < chunkDirty.size(); ++chunk) markDirty(static_cast<Address>(chunk) * snapshotChunkSpan);
+    }
+
+#ifdef ALLOCATOR_INSTRUMENT
+    // Indexed like kStrategies, with a final slot for unknown strategies
+    struct StrategyMetrics {
+        LatencyHistogram latency;
+        LatencyHistogram scanned;
+        std::uint64_t successes = 0;
+        std::uint64_t failures = 0;
+    };
+    std::array<StrategyMetrics, 6> strategyMetrics;
+    LatencyHistogram releaseLatency;
+    LatencyHistogram compactLatency;
+    long long scannedBlocks = 0;
+#endif
+
+    // Start of the block handed out by the most recent successful allocation
+    Address lastAllocated = -1;
+
+    // Every request is rounded up to, and aligned on, a multiple of this
+    Address granularity = 1;
+
+    // Units owned and the cap on them, indexed by handle so the quota check is O(1)
+    struct Account {
+        long long used = 0;
+        long long quota = -1;  // no cap
+    };
+    std::vector<Account> accounts;
+
+    Account& accountOf(ProcessHandle process) {
+        if (process >= accounts.size()) accounts.resize(process + 1);
+        return accounts[process];
+    }
+
+    bool withinQuota(ProcessHandle process, Address extra) const {
+        if (process >= accounts.size() || accounts[process].quota < 0) return true;
+        return accounts[process].used + extra <= accounts[process].quota;
+    }
+
+    BlockIter blockContaining(Address address) {
+        auto it = blocks.upper_bound(address);
+        return it == blocks.begin() ? it : std::prev(it);
+    }
+
+    // Carve `size` units for `process` from the front of the free block at `it`
+    void allocateAt(BlockIter it, ProcessHandle process, Address size) {
+        Block& hole = it->second;
+        unindexFreeBlock(hole);
+
+        if (hole.size() > size) {
+            Address end = hole.start + size - 1;
+            auto rest = insertBlock(std::next(it), end + 1, hole.end);
+            indexFreeBlock(rest->second);
+            hole.end = end;
+            ++splitCount;
+        }
+
+        hole.process = process;
+        blocksByProcess[process].push_back(hole.start);
+        accountOf(process).used += hole.size();
+        lastAllocated = hole.start;
+    }
+
+    // Units to skip at the front of a free block at `start` to reach a multiple of `alignment`
+    static Address paddingFor(Address start, Address alignment) {
+        return ((start + alignment - 1) & ~(alignment - 1)) - start;
+    }
+
+    static bool fitsAligned(Address start, Address holeSize, Address size, Address alignment) {
+        return holeSize >= size && paddingFor(start, alignment) <= holeSize - size;
+    }
+
+    // Lowest-address free block at or after `from` that can hold `size` aligned units, or -1
+    Address firstFitFrom(Address size, Address alignment, Address from) {
+        for (Address start = freeByAddress.firstFit(size, from); start >= 0;
+             start = freeByAddress.firstFit(size, start + 1)) {
+            ALLOCATOR_COUNT_SCANNED(1);
+            if (alignment == 1 || fitsAligned(start, blocks.find(start)->second.size(), size, alignment)) return start;
+        }
+        return -1;
+    }
+
+    // allocateAt the first aligned address of the free block at `it`; returns the new block
+    BlockIter allocateAligned(BlockIter it, ProcessHandle process, Address size, Address alignment) {
+        Address padding = paddingFor(it->second.start, alignment);
+        if (padding > 0) it = splitFree(it, it->second.start + padding);
+        allocateAt(it, process, size);
+        return it;
+    }
+
+    // Split the free block at `it` so a free block starts at `address`, and return that one
+    BlockIter splitFree(BlockIter it, Address address) {
+        Block& front = it->second;
+        unindexFreeBlock(front);
+        auto rest = insertBlock(std::next(it), address, front.end);
+        front.end = address - 1;
+        indexFreeBlock(front);
+        indexFreeBlock(rest->second);
+        ++splitCount;
+        return rest;
+    }
+
+    void freeBlock(BlockIter it) {
+        Address start = it->second.start;
+        compactionFrontier = std::min(compactionFrontier, start);
+        accounts[it->second.process].used -= it->second.size();
+        it->second.process = kFreeProcess;
+        indexFreeBlock(it->second);
+        if (!deferCoalescing) {
+            coalesce(it);
+            return;
+        }
+        pendingCoalesce.emplace_back(start, it->second.end);
+        if (coalesceThreshold > 0) {
+            quickReuse[it->second.size()].push_back(start);
+            if (pendingCoalesce.size() >= coalesceThreshold) coalescePending();
+        }
+    }
+
+    // Hand out the most recently released block of exactly `size` units that is still free,
+    // counting the free neighbours an eager release would have merged it with
+    bool reuseExact(ProcessHandle process, Address size, Address alignment) {
+        auto list = quickReuse.find(size);
+        if (list == quickReuse.end()) return false;
+
+        std::vector<Address>& starts = list->second;
+        while (!starts.empty()) {
+            auto it = blocks.find(starts.back());
+            starts.pop_back();
+            // Entries go stale when their block is merged, reused or compacted away
+            if (it == blocks.end() || !it->second.isFree() || it->second.size() != size ||
+                paddingFor(it->first, alignment) != 0)
+                continue;
+            auto next = std::next(it);
+            mergesAvoided += (next != blocks.end() && next->second.isFree()) +
+                             (it != blocks.begin() && std::prev(it)->second.isFree());
+            allocateAt(it, process, size);
+            return true;
+        }
+        quickReuse.erase(list);
+        return false;
+    }
+
+    // Absorb the free block after `it` into `it`; both must be free
+    void mergeWithNext(BlockIter it) {
+        auto next = std::next(it);
+        unindexFreeBlock(it->second);
+        unindexFreeBlock(next->second);
+        it->second.end = next->second.end;
+        blocks.erase(next);
+        indexFreeBlock(it->second);
+        ++mergeCount;
+    }
+
+    // Merge every block released while coalescing was deferred. Since its release, a pending
+    // range may have been merged into a neighbour or had any number of allocations carved out
+    // of it, so every free block from the one before the range to the one after it is merged.
+    void coalescePending() {
+        for (const auto& range : pendingCoalesce) {
+            auto it = blockContaining(range.first);
+            if (it != blocks.begin()) --it;
+            for (; it != blocks.end() && it->first <= range.second + 1; ++it)
+                if (it->second.isFree()) it = coalesce(it);
+        }
+        pendingCoalesce.clear();
+        quickReuse.clear();
+    }
+
+    // Merge a newly freed block with its free neighbours
+    BlockIter coalesce(BlockIter it) {
+        auto next = std::next(it);
+        if (next != blocks.end() && next->second.isFree()) mergeWithNext(it);
+
+        if (it != blocks.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.isFree()) {
+                mergeWithNext(prev);
+                it = prev;
+            }
+        }
+        return it;
+    }
+
+    // Move the allocated block that follows the free block `hole` down into it. Returns the
+    // free block left behind, already merged with any free block after it.
+    BlockIter slideIntoHole(BlockIter hole, std::vector<Relocation>* relocations = nullptr) {
+        auto moved = std::next(hole);
+        Block block = moved->second;
+        Address newStart = hole->second.start;
+        Address newEnd = newStart + block.size() - 1;
+        if (relocations) relocations->push_back({block.process, block.start, newStart, block.size()});
+        ++relocatedCount;
+
+        unindexFreeBlock(hole->second);
+        hole->second.end = newEnd;
+        hole->second.process = block.process;
+        std::vector<Address>& owned = blocksByProcess[block.process];
+        *std::find(owned.begin(), owned.end(), block.start) = newStart;
+
+        markDirty(block.start);
+        blocks.erase(moved);
+        auto rest = insertBlock(std::next(hole), newEnd + 1, block.end);
+        indexFreeBlock(rest->second);
+        return coalesce(rest);
+    }
+
+public:
+    explicit BasicMemoryAllocator(Address size) : maxMemory(size) {
+        auto it = insertBlock(blocks.end(), 0, size - 1);
+        indexFreeBlock(it->second);
+    }
+
+    // Every strategy takes an `alignment`, a power of two: the block starts at a multiple of it,
+    // and the padding in front stays free as a block of its own
+    bool allocateFirstFit(ProcessHandle process, Address size, Address alignment = 1) {
+        Address start = firstFitFrom(size, alignment, std::numeric_limits<Address>::min());
+        if (start < 0) return false;
+
+        allocateAligned(blocks.find(start), process, size, alignment);
+        return true;
+    }
+
+    bool allocateBestFit(ProcessHandle process, Address size, Address alignment = 1) {
+        auto it = freeBySize.lower_bound({size, std::numeric_limits<Address>::min()});
+        ALLOCATOR_COUNT_SCANNED(1);
+        while (it != freeBySize.end() && !fitsAligned(it->second, it->first, size, alignment)) {
+            ALLOCATOR_COUNT_SCANNED(1);
+            ++it;
+        }
+        if (it == freeBySize.end()) return false;
+
+        allocateAligned(blocks.find(it->second), process, size, alignment);
+        return true;
+    }
+
+    bool allocateWorstFit(ProcessHandle process, Address size, Address alignment = 1) {
+        ALLOCATOR_COUNT_SCANNED(1);
+        Address largest = freeByAddress.largest();
+        if (largest == 0 || largest < size) return false;
+
+        // Largest hole, lowest address among equally large ones
+        if (alignment == 1) {
+            allocateAt(blocks.find(freeByAddress.firstFit(largest)), process, size);
+            return true;
+        }
+        // Aligned: walk down the sizes, trying each size's holes from the lowest address
+        for (auto group = freeBySize.rbegin(); group != freeBySize.rend() && group->first >= size;) {
+            auto first = freeBySize.lower_bound({group->first, std::numeric_limits<Address>::min()});
+            for (auto it = first; it != freeBySize.end() && it->first == group->first; ++it) {
+                ALLOCATOR_COUNT_SCANNED(1);
+                if (!fitsAligned(it->second, it->first, size, alignment)) continue;
+                allocateAligned(blocks.find(it->second), process, size, alignment);
+                return true;
+            }
+            group = std::make_reverse_iterator(first);
+        }
+        return false;
+    }
+
+    bool allocateNextFit(ProcessHandle process, Address size, Address alignment = 1) {
+        Address from = blockContaining(nextFitCursor)->first;
+        Address start = firstFitFrom(size, alignment, from);
+        if (start < 0) start = firstFitFrom(size, alignment, std::numeric_limits<Address>::min());
+        if (start < 0) return false;
+
+        auto it = allocateAligned(blocks.find(start), process, size, alignment);
+        nextFitCursor = (it->second.end + 1) % maxMemory;
+        return true;
+    }
+
+    // Takes a block from the smallest size class whose every member fits, splitting it;
+    // when no such class has blocks, only the request's own class can still hold a fit.
+    // Any block of size + alignment - 1 units fits once aligned.
+    bool allocateSegregatedFit(ProcessHandle process, Address size, Address alignment = 1) {
+        if (size <= 0) return false;
+
+        Address needed = size + alignment - 1;
+        int cls = sizeClassOf(needed);
+        if (needed & (needed - 1)) ++cls;
+
+        std::uint64_t candidates = cls < kSizeClasses ? nonEmptyClasses & (~std::uint64_t(0) << cls) : 0;
+        if (candidates == 0) return allocateBestFit(process, size, alignment);
+
+        ALLOCATOR_COUNT_SCANNED(1);
+        Address start = sizeClassFree[lowestSetBit64(candidates)].back();
+        allocateAligned(blocks.find(start), process, size, alignment);
+        return true;
+    }
+
+    // Round every request up to a multiple of `units`, a power of two, and align it to that
+    // multiple, so blocks start and end on those boundaries (cache lines, pages). Set it before
+    // the first request. Returns false if `units` is not a power of two.
+    bool setGranularity(Address units) {
+        if (units <= 0 || (units & (units - 1))) return false;
+        granularity = units;
+        return true;
+    }
+
+    static bool isAlignment(long long alignment) {
+        return alignment > 0 && (alignment & (alignment - 1)) == 0;
+    }
+
+    ProcessHandle internProcess(const std::string& name) {
+        return processes.intern(name);
+    }
+
+    const std::string& processName(ProcessHandle process) const {
+        return processes.name(process);
+    }
+
+    Address capacity() const {
+        return maxMemory;
+    }
+
+    // Every interned name, indexed by handle
+    const std::vector<std::string>& processNames() const {
+        return processes.all();
+    }
+
+    bool allocateFirstFit(const std::string& process, Address size, Address alignment = 1) {
+        return allocateFirstFit(internProcess(process), size, alignment);
+    }
+
+    bool allocateBestFit(const std::string& process, Address size, Address alignment = 1) {
+        return allocateBestFit(internProcess(process), size, alignment);
+    }
+
+    bool allocateWorstFit(const std::string& process, Address size, Address alignment = 1) {
+        return allocateWorstFit(internProcess(process), size, alignment);
+    }
+
+    bool allocateNextFit(const std::string& process, Address size, Address alignment = 1) {
+        return allocateNextFit(internProcess(process), size, alignment);
+    }
+
+    bool allocateSegregatedFit(const std::string& process, Address size, Address alignment = 1) {
+        return allocateSegregatedFit(internProcess(process), size, alignment);
+    }
+
+
+    bool release(const std::string& process) override {
+        ProcessHandle handle = processes.find(process);
+        return handle != kFreeProcess && release(handle);
+    }
+
+    bool release(ProcessHandle process) {
+        ALLOCATOR_TIME_SCOPE(releaseLatency);
+        if (backgroundCompactionBudget > 0) compactStep(backgroundCompactionBudget);
+
+        auto owned = blocksByProcess.find(process);
+        if (owned == blocksByProcess.end()) return false;
+
+        for (Address start : owned->second) freeBlock(blocks.find(start));
+        blocksByProcess.erase(owned);
+        return true;
+    }
+
+    // Frees the single block starting at `start`, leaving the owner's other blocks alone
+    bool releaseBlock(Address start) {
+        auto it = blocks.find(start);
+        if (it == blocks.end() || it->second.isFree()) return false;
+
+        auto owned = blocksByProcess.find(it->second.process);
+        std::vector<Address>& starts = owned->second;
+        starts.erase(std::find(starts.begin(), starts.end(), start));
+        if (starts.empty()) blocksByProcess.erase(owned);
+
+        freeBlock(it);
+        return true;
+    }
+
+    // Resizes the block starting at `start` to `newSize` units (rounded up to the granularity).
+    // Shrinking returns the tail to the free index; growing takes the front of a free block
+    // right after it. Only when neither works is the block moved to wherever first-fit finds
+    // room, the old space included. `result` tells where the block ended up. Fails, changing
+    // nothing, if there is no room or the owner's quota would be exceeded.
+    bool resizeBlock(Address start, Address newSize, Relocation& result) {
+        auto it = blocks.find(start);
+        if (it == blocks.end() || it->second.isFree() || newSize <= 0) return false;
+        if (granularity > 1) newSize = (newSize + granularity - 1) & ~(granularity - 1);
+
+        Block& block = it->second;
+        ProcessHandle process = block.process;
+        Address oldSize = block.size();
+        result = {process, start, start, newSize};
+        if (newSize == oldSize) return true;
+        if (newSize > oldSize && !withinQuota(process, newSize - oldSize)) return false;
+        markDirty(start);
+
+        if (newSize < oldSize) {
+            auto tail = insertBlock(std::next(it), start + newSize, block.end, process);
+            block.end = start + newSize - 1;
+            freeBlock(tail);
+            return true;
+        }
+
+        Address growth = newSize - oldSize;
+        auto next = std::next(it);
+        if (next != blocks.end() && next->second.isFree() && next->second.size() >= growth) {
+            Block& hole = next->second;
+            unindexFreeBlock(hole);
+            if (hole.size() > growth) {
+                auto rest = insertBlock(std::next(next), hole.start + growth, hole.end);
+                indexFreeBlock(rest->second);
+                ++splitCount;
+            }
+            blocks.erase(next);
+            block.end += growth;
+            accounts[process].used += growth;
+            return true;
+        }
+
+        // Last resort: free the block and place it afresh, once sure that will succeed, either
+        // in a hole elsewhere or in the block merged with its free neighbours
+        Address room = oldSize, roomStart = start;
+        if (next != blocks.end() && next->second.isFree()) room += next->second.size();
+        if (it != blocks.begin() && std::prev(it)->second.isFree()) {
+            roomStart = std::prev(it)->second.start;
+            room += std::prev(it)->second.size();
+        }
+        Address alignment = granularity, lowest = std::numeric_limits<Address>::min();
+        if (!fitsAligned(roomStart, room, newSize, alignment) && firstFitFrom(newSize, alignment, lowest) < 0)
+            return false;
+
+        std::vector<Address>& owned = blocksByProcess[process];
+        owned.erase(std::find(owned.begin(), owned.end(), start));
+        freeBlock(it);
+        if (deferCoalescing) coalesce(blockContaining(start));
+        auto placed = allocateAligned(blocks.find(firstFitFrom(newSize, alignment, lowest)), process, newSize, alignment);
+        result.newStart = placed->second.start;
+        if (result.newStart != start) ++relocatedCount;
+        return true;
+    }
+
+    // Resizes the block most recently given to `process`
+    bool resize(ProcessHandle process, Address newSize, Relocation& result) {
+        auto owned = blocksByProcess.find(process);
+        return owned != blocksByProcess.end() && !owned->second.empty() &&
+               resizeBlock(owned->second.back(), newSize, result);
+    }
+
+    bool resize(const std::string& process, Address newSize, Relocation& result) {
+        ProcessHandle handle = processes.find(process);
+        return handle != kFreeProcess && resize(handle, newSize, result);
+    }
+
+    // Caps the units `process` may own at once; a negative quota removes the cap
+    void setQuota(ProcessHandle process, long long units) {
+        accountOf(process).quota = units < 0 ? -1 : units;
+    }
+
+    // Units `process` owns, and its quota or -1
+    long long usage(ProcessHandle process) const {
+        return process < accounts.size() ? accounts[process].used : 0;
+    }
+
+    long long quota(ProcessHandle process) const {
+        return process < accounts.size() ? accounts[process].quota : -1;
+    }
+
+    void mergeAdjacentFreeBlocks() {
+        for (auto it = blocks.begin(); it != blocks.end();) {
+            auto next = std::next(it);
+            if (next == blocks.end()) break;
+            if (it->second.isFree() && next->second.isFree()) {
+                mergeWithNext(it);
+            } else {
+                it = next;
+            }
+        }
+    }
+
+    void compact() override {
+        ALLOCATOR_TIME_SCOPE(compactLatency);
+        std::map<Address, Block> newBlocks;
+        Address nextFreeAddress = 0;
+        std::unordered_map<Address, Address> moved;
+
+        for (const auto& entry : blocks) {
+            const Block& block = entry.second;
+            if (!block.isFree()) {
+                Address sz = block.size();
+                if (block.start != nextFreeAddress) {
+                    ++relocatedCount;
+                    moved.emplace(block.start, nextFreeAddress);
+                }
+                newBlocks.emplace_hint(newBlocks.end(), nextFreeAddress,
+                                       Block(nextFreeAddress, nextFreeAddress + sz - 1, block.process));
+                nextFreeAddress += sz;
+            }
+        }
+        // Owner lists keep their order, so resize() still finds each process's newest block
+        for (auto& owned : blocksByProcess) {
+            for (Address& start : owned.second) {
+                auto it = moved.find(start);
+                if (it != moved.end()) start = it->second;
+            }
+        }
+
+        if (nextFreeAddress < maxMemory)
+            newBlocks.emplace_hint(newBlocks.end(), nextFreeAddress,
+                                   Block(nextFreeAddress, maxMemory - 1));
+
+        blocks = std::move(newBlocks);
+        ++compactionCount;
+        markAllDirty();
+        pendingCoalesce.clear();
+        quickReuse.clear();
+        compactionFrontier = nextFreeAddress;
+        nextFitCursor = nextFreeAddress < maxMemory ? nextFreeAddress : 0;
+
+        clearFreeIndex();
+        if (!blocks.empty() && blocks.rbegin()->second.isFree())
+            indexFreeBlock(blocks.rbegin()->second);
+    }
+
+    struct CompactionProgress {
+        int blocksMoved = 0;
+        long long unitsMoved = 0;
+        bool done = false;
+    };
+
+    // Bounded-pause compaction: slides at most `maxBlocks` blocks down towards address 0.
+    // The block map is consistent after every move, so allocation and release may run
+    // between steps; a release below the frontier pulls it back.
+    CompactionProgress compactStep(int maxBlocks) {
+        CompactionProgress progress;
+        auto hole = blockContaining(compactionFrontier);
+
+        while (hole != blocks.end()) {
+            while (hole != blocks.end() && !hole->second.isFree()) ++hole;
+            if (hole == blocks.end()) break;
+
+            auto next = std::next(hole);
+            if (next == blocks.end()) break;
+            if (next->second.isFree()) {
+                mergeWithNext(hole);
+                continue;
+            }
+            if (progress.blocksMoved == maxBlocks) {
+                compactionFrontier = hole->second.start;
+                return progress;
+            }
+
+            progress.unitsMoved += next->second.size();
+            ++progress.blocksMoved;
+            hole = slideIntoHole(hole);
+        }
+
+        if (progress.blocksMoved > 0) ++compactionCount;
+
+        compactionFrontier = hole == blocks.end() ? maxMemory : hole->second.start;
+        progress.done = true;
+        return progress;
+    }
+
+    // Create one hole of at least `requiredSize` units (0: all free space) while moving as few
+    // units as possible. Picks the run of consecutive holes holding enough free space with the
+    // fewest allocated units between them, then slides only those blocks down. Blocks outside
+    // the run stay put. Returns false if there is not enough free space in total.
+    bool compactMinimal(Address requiredSize, std::vector<Relocation>& relocations) {
+        long long totalFree = freeUnits();
+        if (requiredSize <= 0) requiredSize = static_cast<Address>(totalFree);
+        if (requiredSize > totalFree) return false;
+        if (freeByAddress.largest() >= requiredSize) return true;
+
+        // Holes in address order, with the allocated units between each hole and the next
+        std::vector<BlockIter> holes;
+        std::vector<long long> gapAfter;
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            if (it->second.isFree()) {
+                holes.push_back(it);
+                gapAfter.push_back(0);
+            } else if (!holes.empty()) {
+                gapAfter.back() += it->second.size();
+            }
+        }
+
+        size_t bestFirst = 0;
+        long long bestCost = std::numeric_limits<long long>::max();
+        long long windowFree = 0, windowCost = 0;
+        for (size_t first = 0, last = 0; first < holes.size(); ++first) {
+            while (last < holes.size() && windowFree < requiredSize) {
+                if (last > first) windowCost += gapAfter[last - 1];
+                windowFree += holes[last]->second.size();
+                ++last;
+            }
+            if (windowFree < requiredSize) break;
+            if (windowCost < bestCost) {
+                bestCost = windowCost;
+                bestFirst = first;
+            }
+            windowFree -= holes[first]->second.size();
+            if (first + 1 < last) windowCost -= gapAfter[first];
+        }
+
+        BlockIter hole = holes[bestFirst];
+        while (hole->second.size() < requiredSize) {
+            if (std::next(hole)->second.isFree()) mergeWithNext(hole);
+            else hole = slideIntoHole(hole, &relocations);
+        }
+        ++compactionCount;
+        return true;
+    }
+
+    // Run a compaction step of `maxBlocks` moves before every request; 0 turns it off
+    void setBackgroundCompaction(int maxBlocks) {
+        backgroundCompactionBudget = std::max(0, maxBlocks);
+    }
+
+    void setCompactionPolicy(CompactionPolicy policy) {
+        compactionPolicy = policy;
+    }
+
+    // With `pending` > 0, released blocks are merged only once that many wait or a request
+    // finds no hole, and requests of a just-released size reuse such a block directly.
+    // 0 merges on every release again, starting with whatever is pending.
+    void setCoalesceThreshold(size_t pending) {
+        coalesceThreshold = pending;
+        deferCoalescing = pending > 0;
+        if (!deferCoalescing) coalescePending();
+    }
+
+    // Whether released blocks still wait to be merged with their neighbours
+    bool coalescingPending() const {
+        return !pendingCoalesce.empty();
+    }
+
+    const CompactionReport& lastCompactionReport() const {
+        return lastCompaction;
+    }
+
+    long long freeUnits() const {
+        return totalFreeUnits;
+    }
+
+    Stats stats() const {
+        Stats result;
+        result.freeUnits = totalFreeUnits;
+        result.usedUnits = maxMemory - totalFreeUnits;
+        result.freeBlocks = freeBySize.size();
+        result.usedBlocks = blocks.size() - freeBySize.size();
+        result.largestFree = freeByAddress.largest();
+        result.externalFragmentation =
+            totalFreeUnits ? 1.0 - static_cast<double>(result.largestFree) / totalFreeUnits : 0.0;
+        result.splits = splitCount;
+        result.merges = mergeCount;
+        result.compactions = compactionCount;
+        result.blocksRelocated = relocatedCount;
+        result.mergesAvoided = mergesAvoided;
+        for (int cls = 0; cls < kSizeClasses; ++cls) {
+            result.freeBlocksByClass[cls] = sizeClassFree[cls].size();
+            result.freeUnitsByClass[cls] = sizeClassUnits[cls];
+        }
+        return result;
+    }
+
+    template <typename Visitor>
+    void forEachBlock(Visitor visit) const {
+        for (const auto& entry : blocks) visit(entry.second);
+    }
+
+    // Visits the blocks overlapping addresses [from, to] in address order
+    template <typename Visitor>
+    void forEachBlockIn(Address from, Address to, Visitor visit) const {
+        auto it = blocks.upper_bound(from);
+        if (it != blocks.begin()) --it;
+        for (; it != blocks.end() && it->first <= to; ++it) visit(it->second);
+    }
+
+    // Start publishing snapshots in chunks of `chunkSpan` addresses
+    void enableSnapshots(Address chunkSpan) {
+        snapshotChunkSpan = std::max<Address>(1, chunkSpan);
+        size_t chunkCount = static_cast<size_t>((maxMemory + snapshotChunkSpan - 1) / snapshotChunkSpan);
+        chunkDirty.assign(chunkCount, 0);
+        dirtyChunks.clear();
+
+        auto empty = std::make_shared<Snapshot>();
+        empty->chunks.assign(chunkCount, std::make_shared<const typename Snapshot::Chunk>());
+        empty->processNames = std::make_shared<const std::vector<std::string>>();
+        std::atomic_store(&published, std::shared_ptr<const Snapshot>(std::move(empty)));
+
+        markAllDirty();
+        publishSnapshot();
+    }
+
+    // Make the current block map visible to snapshot() readers. Only the chunks changed since
+    // the last publish are rebuilt; callers serialise this with other writers.
+    void publishSnapshot() {
+        if (snapshotChunkSpan == 0 || dirtyChunks.empty()) return;
+
+        auto next = std::make_shared<Snapshot>(*std::atomic_load(&published));
+        ++next->version;
+
+        for (size_t chunk : dirtyChunks) {
+            auto rebuilt = std::make_shared<typename Snapshot::Chunk>();
+            Address from = static_cast<Address>(chunk) * snapshotChunkSpan;
+            for (auto it = blocks.lower_bound(from); it != blocks.end() && it->first < from + snapshotChunkSpan; ++it) {
+                rebuilt->blocks.push_back(it->second);
+                (it->second.isFree() ? rebuilt->freeUnits : rebuilt->usedUnits) += it->second.size();
+            }
+
+            next->usedUnits += rebuilt->usedUnits - next->chunks[chunk]->usedUnits;
+            next->freeUnits += rebuilt->freeUnits - next->chunks[chunk]->freeUnits;
+            next->chunks[chunk] = std::move(rebuilt);
+            chunkDirty[chunk] = 0;
+        }
+        dirtyChunks.clear();
+
+        if (next->processNames->size() != processes.all().size())
+            next->processNames = std::make_shared<const std::vector<std::string>>(processes.all());
+
+        std::atomic_store(&published, std::shared_ptr<const Snapshot>(std::move(next)));
+    }
+
+    // Latest published snapshot, or null when snapshots are off. Safe to call from any thread.
+    std::shared_ptr<const Snapshot> snapshot() const {
+        return std::atomic_load(&published);
+    }
+
+    // Checkpoint of the whole allocator (SAVE / LOAD), taken between requests. Layout, all
+    // little-endian: "MACK", u32 version, u32 sizeof(Address), u32 name count, u32 compaction
+    // policy, u64 block count; i64 memory size, next-fit cursor, compaction frontier,
+    // background budget, granularity and coalescing threshold; i64 splits, merges, compactions,
+    // relocated blocks and merges avoided; the names after the empty one as u32 length and
+    // bytes; the blocks in address order as start, end and u32 owner; the free starts in
+    // (size, start) order; per size class a u64 count and its list as kept; per named process
+    // a u64 count and the starts it owns in allocation order; per named process its i64 quota,
+    // -1 for none; the released ranges waiting to coalesce as one list of start, end pairs
+    // (the count is of addresses); then a u64 count of quick-reuse sizes and, by ascending
+    // size, an i64 size and its list. Addresses are sizeof(Address) wide. Every array is
+    // stored in the order its index keeps it, so restore never sorts and the restored
+    // allocator behaves identically.
+    static constexpr char kCheckpointMagic[4] = {'M', 'A', 'C', 'K'};
+    static constexpr std::uint32_t kCheckpointVersion = 7;
+    // A block's start, end and owner, field by field so no struct padding reaches the file
+    static constexpr size_t kBlockRecordBytes = 2 * sizeof(Address) + sizeof(ProcessHandle);
+
+    void save(std::string& out) const {
+        auto put = [&out](const void* data, size_t bytes) { out.append(static_cast<const char*>(data), bytes); };
+        auto putU32 = [&](std::uint32_t value) { put(&value, sizeof(value)); };
+        auto putI64 = [&](std::int64_t value) { put(&value, sizeof(value)); };
+        auto putBlock = [&](const Block& block) {
+            put(&block.start, sizeof(Address));
+            put(&block.end, sizeof(Address));
+            put(&block.process, sizeof(ProcessHandle));
+        };
+        auto putList = [&](const std::vector<Address>& list) {
+            putI64(static_cast<std::int64_t>(list.size()));
+            put(list.data(), list.size() * sizeof(Address));
+        };
+
+        const std::vector<std::string>& names = processes.all();
+        out.reserve(out.size() + 128 + kBlockRecordBytes * blocks.size() + 2 * sizeof(Address) * freeBySize.size());
+        put(kCheckpointMagic, sizeof(kCheckpointMagic));
+        for (std::uint32_t field : {kCheckpointVersion, static_cast<std::uint32_t>(sizeof(Address)),
+                                    static_cast<std::uint32_t>(names.size()), static_cast<std::uint32_t>(compactionPolicy)})
+            putU32(field);
+        putI64(static_cast<std::int64_t>(blocks.size()));
+        for (std::int64_t field : {std::int64_t(maxMemory), std::int64_t(nextFitCursor), std::int64_t(compactionFrontier),
+                                   std::int64_t(backgroundCompactionBudget), std::int64_t(granularity),
+                                   std::int64_t(coalesceThreshold)})
+            putI64(field);
+        for (long long counter : {splitCount, mergeCount, compactionCount, relocatedCount, mergesAvoided})
+            putI64(counter);
+
+        for (size_t handle = 1; handle < names.size(); ++handle) {
+            putU32(static_cast<std::uint32_t>(names[handle].size()));
+            put(names[handle].data(), names[handle].size());
+        }
+        for (const auto& entry : blocks) putBlock(entry.second);
+        for (const auto& hole : freeBySize) put(&hole.second, sizeof(Address));
+        for (const auto& list : sizeClassFree) putList(list);
+        const std::vector<Address> none;
+        for (ProcessHandle handle = 1; handle < names.size(); ++handle) {
+            auto owned = blocksByProcess.find(handle);
+            putList(owned == blocksByProcess.end() ? none : owned->second);
+        }
+        for (ProcessHandle handle = 1; handle < names.size(); ++handle) putI64(quota(handle));
+        std::vector<Address> pendingRanges;
+        for (const auto& range : pendingCoalesce) {
+            pendingRanges.push_back(range.first);
+            pendingRanges.push_back(range.second);
+        }
+        putList(pendingRanges);
+        // By size, so saving the same allocator twice gives the same bytes
+        std::vector<Address> reuseSizes;
+        for (const auto& list : quickReuse) reuseSizes.push_back(list.first);
+        std::sort(reuseSizes.begin(), reuseSizes.end());
+        putI64(static_cast<std::int64_t>(reuseSizes.size()));
+        for (Address length : reuseSizes) {
+            putI64(length);
+            putList(quickReuse.at(length));
+        }
+    }
+
+    // Rebuilds an allocator from save() output in time linear in its size, or returns null if
+    // the data is truncated, from another version or address width, or describes an
+    // inconsistent heap
+    static std::unique_ptr<BasicMemoryAllocator> restore(const char* data, size_t size) {
+        size_t pos = 0;
+        auto take = [&](void* value, size_t bytes) {
+            if (size - pos < bytes) return false;
+            if (bytes) std::memcpy(value, data + pos, bytes);
+            pos += bytes;
+            return true;
+        };
+        auto takeList = [&](std::vector<Address>& list) {
+            std::int64_t count;
+            if (!take(&count, sizeof(count)) || count < 0 ||
+                (size - pos) / sizeof(Address) < static_cast<std::uint64_t>(count))
+                return false;
+            list.resize(static_cast<size_t>(count));
+            return take(list.data(), list.size() * sizeof(Address));
+        };
+
+        char magic[4];
+        std::uint32_t header[4];  // version, address width, name count, compaction policy
+        std::int64_t blockCount, fields[6], counters[5];
+        if (!take(magic, sizeof(magic)) || std::memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0 ||
+            !take(header, sizeof(header)) || header[0] != kCheckpointVersion || header[1] != sizeof(Address) ||
+            header[2] == 0 || header[3] > 1 || !take(&blockCount, sizeof(blockCount)) || blockCount <= 0 ||
+            !take(fields, sizeof(fields)) || !take(counters, sizeof(counters)) || fields[0] <= 0 ||
+            fields[0] > std::numeric_limits<Address>::max() || fields[3] < 0 ||
+            fields[3] > std::numeric_limits<int>::max() || !isAlignment(fields[4]) || fields[4] > fields[0] ||
+            fields[5] < 0)
+            return nullptr;
+        std::uint32_t nameCount = header[2];
+        Address memorySize = static_cast<Address>(fields[0]);
+
+        auto allocator = std::make_unique<BasicMemoryAllocator>(memorySize);
+        BasicMemoryAllocator& a = *allocator;
+        a.compactionPolicy = static_cast<CompactionPolicy>(header[3]);
+        a.nextFitCursor = static_cast<Address>(fields[1]);
+        a.compactionFrontier = static_cast<Address>(fields[2]);
+        a.backgroundCompactionBudget = static_cast<int>(fields[3]);
+        a.granularity = static_cast<Address>(fields[4]);
+        a.coalesceThreshold = static_cast<size_t>(fields[5]);
+        a.deferCoalescing = a.coalesceThreshold > 0;
+        a.splitCount = counters[0];
+        a.mergeCount = counters[1];
+        a.compactionCount = counters[2];
+        a.relocatedCount = counters[3];
+        a.mergesAvoided = counters[4];
+
+        for (std::uint32_t handle = 1; handle < nameCount; ++handle) {
+            std::uint32_t length;
+            if (!take(&length, sizeof(length)) || size - pos < length) return nullptr;
+            if (a.processes.intern(std::string(data + pos, length)) != handle) return nullptr;
+            pos += length;
+        }
+
+        // Blocks must tile [0, memorySize) exactly and name known processes
+        a.blocks.clear();
+        a.clearFreeIndex();
+        std::vector<std::pair<Address, Address>> holes;
+        size_t usedBlocks = 0;
+        Address expectedStart = 0;
+        if ((size - pos) / kBlockRecordBytes < static_cast<std::uint64_t>(blockCount)) return nullptr;
+        for (std::int64_t i = 0; i < blockCount; ++i) {
+            Block block;
+            take(&block.start, sizeof(Address));
+            take(&block.end, sizeof(Address));
+            take(&block.process, sizeof(ProcessHandle));
+            if (block.start != expectedStart || block.end < block.start || block.end >= memorySize ||
+                block.process >= nameCount)
+                return nullptr;
+            a.blocks.emplace_hint(a.blocks.end(), block.start, block);
+            if (block.isFree()) {
+                holes.emplace_back(block.start, block.size());
+            } else {
+                ++usedBlocks;
+                a.accountOf(block.process).used += block.size();
+            }
+            expectedStart = block.end + 1;
+        }
+        if (expectedStart != memorySize || a.nextFitCursor < 0 || a.nextFitCursor >= memorySize ||
+            a.compactionFrontier < 0)
+            return nullptr;
+        a.freeByAddress.assignSorted(holes);
+
+        for (size_t i = 0; i < holes.size(); ++i) {
+            Address start;
+            if (!take(&start, sizeof(start))) return nullptr;
+            auto it = a.blocks.find(start);
+            if (it == a.blocks.end() || !it->second.isFree()) return nullptr;
+            a.freeBySize.emplace_hint(a.freeBySize.end(), it->second.size(), it->second.start);
+        }
+        if (a.freeBySize.size() != holes.size()) return nullptr;
+
+        size_t listed = 0;
+        a.sizeClassSlot.reserve(holes.size());
+        for (int cls = 0; cls < kSizeClasses; ++cls) {
+            std::vector<Address>& list = a.sizeClassFree[cls];
+            if (!takeList(list)) return nullptr;
+            for (size_t slot = 0; slot < list.size(); ++slot) {
+                auto it = a.blocks.find(list[slot]);
+                if (it == a.blocks.end() || !it->second.isFree() || sizeClassOf(it->second.size()) != cls ||
+                    !a.sizeClassSlot.emplace(list[slot], slot).second)
+                    return nullptr;
+                a.sizeClassUnits[cls] += it->second.size();
+                a.totalFreeUnits += it->second.size();
+            }
+            if (!list.empty()) a.nonEmptyClasses |= std::uint64_t(1) << cls;
+            listed += list.size();
+        }
+        if (listed != holes.size()) return nullptr;
+
+        // Each allocated block on exactly one list, its owner's, and on it once
+        size_t owned = 0;
+        std::unordered_set<Address> listedOwned;
+        listedOwned.reserve(usedBlocks);
+        for (ProcessHandle handle = 1; handle < nameCount; ++handle) {
+            std::vector<Address> starts;
+            if (!takeList(starts)) return nullptr;
+            if (starts.empty()) continue;
+            for (Address start : starts) {
+                auto it = a.blocks.find(start);
+                if (it == a.blocks.end() || it->second.process != handle || !listedOwned.insert(start).second)
+                    return nullptr;
+            }
+            owned += starts.size();
+            a.blocksByProcess.emplace(handle, std::move(starts));
+        }
+        if (owned != usedBlocks) return nullptr;
+
+        for (ProcessHandle handle = 1; handle < nameCount; ++handle) {
+            std::int64_t quota;
+            if (!take(&quota, sizeof(quota)) || quota < -1) return nullptr;
+            if (quota >= 0) a.setQuota(handle, quota);
+        }
+
+        // Only deferred-coalescing mode leaves merges pending between requests
+        std::int64_t reuseSizes;
+        std::vector<Address> pendingRanges;
+        if (!takeList(pendingRanges) || pendingRanges.size() % 2 != 0 || !take(&reuseSizes, sizeof(reuseSizes)) ||
+            reuseSizes < 0 || (!a.deferCoalescing && (!pendingRanges.empty() || reuseSizes > 0)))
+            return nullptr;
+        for (size_t i = 0; i < pendingRanges.size(); i += 2) {
+            if (pendingRanges[i] < 0 || pendingRanges[i] > pendingRanges[i + 1] || pendingRanges[i + 1] >= memorySize)
+                return nullptr;
+            a.pendingCoalesce.emplace_back(pendingRanges[i], pendingRanges[i + 1]);
+        }
+        for (std::int64_t i = 0; i < reuseSizes; ++i) {
+            std::int64_t length;
+            std::vector<Address> starts;
+            if (!take(&length, sizeof(length)) || length <= 0 || length > memorySize || !takeList(starts) ||
+                !a.quickReuse.emplace(static_cast<Address>(length), std::move(starts)).second)
+                return nullptr;
+        }
+        if (pos != size) return nullptr;
+        return allocator;
+    }
+
+    void printStatus() const override {
+        printStatus(0, maxMemory - 1);
+    }
+
+    // Only the blocks overlapping addresses [from, to]
+    void printStatus(Address from, Address to) const {
+        std::cout << "\nMemory Status:\n";
+        forEachBlockIn(from, to, [&](const Block& block) {
+            std::string status = block.isFree() ? "Unused" : "Process " + processName(block.process);
+            std::cout << "Addresses [" << block.start << ":" << block.end << "] "
+                      << status << " | Size: " << block.size() << "\n";
+        });
+        std::cout << "\n";
+    }
+
+    // One-line digest from the running counters, O(1) however large the heap
+    void printSummary() const {
+        Stats current = stats();
+        std::cout << "Blocks: " << current.usedBlocks << " used, " << current.freeBlocks << " free | Used: "
+                  << current.usedUnits << " | Free: " << current.freeUnits << " | Largest free: "
+                  << current.largestFree << " | Fragmentation: " << std::fixed << std::setprecision(1)
+                  << 100 * current.externalFragmentation << "%\n";
+    }
+
+    void printSizeClassStats() const {
+        long long totalFree = freeUnits();
+
+        std::cout << "\nSize Class Status:\n";
+        for (int cls = 0; cls < kSizeClasses; ++cls) {
+            if (sizeClassFree[cls].empty()) continue;
+            std::uint64_t low = std::uint64_t(1) << cls;
+            std::cout << "Class [" << low << ":" << (2 * low - 1) << "] "
+                      << sizeClassFree[cls].size() << " free blocks | Units: " << sizeClassUnits[cls]
+                      << " | Share of free: " << std::fixed << std::setprecision(1)
+                      << (100.0 * sizeClassUnits[cls] / totalFree) << "%\n";
+        }
+        std::cout << "Total free: " << totalFree << "\n";
+    }
+
+    bool processRequest(const std::string& process, int size, char strategy) override {
+        return processRequest(internProcess(process), size, strategy);
+    }
+
+    static constexpr char kStrategies[] = "FBWNS";
+
+    // The strategies as policy types, so a request path can be instantiated per strategy
+    struct FirstFit {
+        static bool allocate(BasicMemoryAllocator& heap, ProcessHandle process, Address size, Address alignment) {
+            return heap.allocateFirstFit(process, size, alignment);
+        }
+    };
+
+    struct BestFit {
+        static bool allocate(BasicMemoryAllocator& heap, ProcessHandle process, Address size, Address alignment) {
+            return heap.allocateBestFit(process, size, alignment);
+        }
+    };
+
+    struct WorstFit {
+        static bool allocate(BasicMemoryAllocator& heap, ProcessHandle process, Address size, Address alignment) {
+            return heap.allocateWorstFit(process, size, alignment);
+        }
+    };
+
+    struct NextFit {
+        static bool allocate(BasicMemoryAllocator& heap, ProcessHandle process, Address size, Address alignment) {
+            return heap.allocateNextFit(process, size, alignment);
+        }
+    };
+
+    struct SegregatedFit {
+        static bool allocate(BasicMemoryAllocator& heap, ProcessHandle process, Address size, Address alignment) {
+            return heap.allocateSegregatedFit(process, size, alignment);
+        }
+    };
+
+    // Like processRequest, but returns the start of the new block, or -1
+    Address allocate(ProcessHandle process, Address size, char strategy, Address alignment = 1) {
+        return processRequest(process, size, strategy, alignment) ? lastAllocated : -1;
+    }
+
+    // processRequest with the strategy fixed at compile time: the first attempt, the retry after
+    // deferred coalescing and the attempt after on-demand compaction all call Strategy directly
+    template <typename Strategy>
+    bool processRequestWith(ProcessHandle process, Address size, Address alignment = 1) {
+        if (process == kFreeProcess || size <= 0) return false;
+        if (!isAlignment(alignment)) {
+            std::cerr << "Error: Alignment " << alignment << " is not a power of two\n";
+            return false;
+        }
+        if (granularity > 1) {
+            size = (size + granularity - 1) & ~(granularity - 1);
+            alignment = std::max(alignment, granularity);
+        }
+        if (backgroundCompactionBudget > 0) compactStep(backgroundCompactionBudget);
+        lastCompaction = CompactionReport();
+        if (!withinQuota(process, size)) return false;
+        if (coalesceThreshold > 0 && reuseExact(process, size, alignment)) return true;
+
+        if (Strategy::allocate(*this, process, size, alignment)) return true;
+        if (!pendingCoalesce.empty()) {
+            coalescePending();
+            if (Strategy::allocate(*this, process, size, alignment)) return true;
+        }
+        if (compactionPolicy != CompactionPolicy::OnDemand || size <= 0 || size > freeUnits()) return false;
+
+        // A hole of size + alignment - 1 units fits the block wherever it ends up starting
+        std::vector<Relocation> relocations;
+        compactMinimal(static_cast<Address>(std::min<long long>(size + alignment - 1, freeUnits())), relocations);
+        lastCompaction.compacted = true;
+        lastCompaction.blocksMoved = static_cast<int>(relocations.size());
+        for (const auto& r : relocations) lastCompaction.unitsMoved += r.size;
+        return Strategy::allocate(*this, process, size, alignment);
+    }
+
+    bool processRequest(ProcessHandle process, Address size, char strategy, Address alignment = 1) {
+#ifdef ALLOCATOR_INSTRUMENT
+        const char* known = std::strchr(kStrategies, std::toupper(strategy));
+        StrategyMetrics& metrics = strategyMetrics[known && *known ? known - kStrategies : strategyMetrics.size() - 1];
+        scannedBlocks = 0;
+        bool allocated;
+        {
+            LatencyHistogram::ScopedTimer timer(metrics.latency);
+            allocated = serveRequest(process, size, strategy, alignment);
+        }
+        metrics.scanned.record(static_cast<std::uint64_t>(scannedBlocks));
+        ++(allocated ? metrics.successes : metrics.failures);
+        return allocated;
+#else
+        return serveRequest(process, size, strategy, alignment);
+#endif
+    }
+
+    // Prometheus text exposition of the occupancy counters and, when compiled in, the
+    // per-operation latency and scan histograms. Counts print as integers and ratios and
+    // latencies with every significant digit, whatever formatting `out` had before.
+    void writePrometheus(std::ostream& out) const {
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << std::defaultfloat << std::setprecision(17);
+
+        Stats current = stats();
+        auto gauge = [&](const char* name, const char* type, const char* help, auto value) {
+            out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n"
+                << name << " " << value << "\n";
+        };
+        gauge("allocator_used_units", "gauge", "Units owned by processes.", current.usedUnits);
+        gauge("allocator_free_units", "gauge", "Units in free blocks.", current.freeUnits);
+        gauge("allocator_used_blocks", "gauge", "Allocated blocks.", current.usedBlocks);
+        gauge("allocator_free_blocks", "gauge", "Free blocks.", current.freeBlocks);
+        gauge("allocator_largest_free_block_units", "gauge", "Size of the largest free block.", current.largestFree);
+        gauge("allocator_external_fragmentation_ratio", "gauge", "1 - largest free block / free units.",
+              current.externalFragmentation);
+        gauge("allocator_splits_total", "counter", "Free blocks split by allocation.", current.splits);
+        gauge("allocator_merges_total", "counter", "Adjacent free blocks merged.", current.merges);
+        gauge("allocator_merges_avoided_total", "counter", "Merges skipped by reusing a deferred block of the same size.",
+              current.mergesAvoided);
+        gauge("allocator_compactions_total", "counter", "Compaction passes that ran.", current.compactions);
+        gauge("allocator_relocated_blocks_total", "counter", "Blocks moved by compaction.", current.blocksRelocated);
+
+#ifdef ALLOCATOR_INSTRUMENT
+        auto summary = [&](const std::string& labels, const LatencyHistogram& histogram, double scale,
+                           const char* name) {
+            for (const char* quantile : {"0.5", "0.99", "0.999"}) {
+                out << name << "{" << labels << (labels.empty() ? "" : ",") << "quantile=\"" << quantile << "\"} "
+                    << histogram.percentile(std::atof(quantile)) * scale << "\n";
+            }
+            std::string braces = labels.empty() ? "" : "{" + labels + "}";
+            out << name << "_sum" << braces << " " << histogram.totalValue() * scale << "\n"
+                << name << "_count" << braces << " " << histogram.count() << "\n";
+        };
+        auto strategyLabel = [](size_t i) {
+            return std::string("strategy=\"") + (i < sizeof(kStrategies) - 1 ? std::string(1, kStrategies[i]) : "unknown") + "\"";
+        };
+
+        out << "# HELP allocator_request_latency_seconds processRequest latency.\n"
+            << "# TYPE allocator_request_latency_seconds summary\n";
+        for (size_t i = 0; i < strategyMetrics.size(); ++i)
+            summary(strategyLabel(i), strategyMetrics[i].latency, 1e-9, "allocator_request_latency_seconds");
+
+        out << "# HELP allocator_request_blocks_scanned Blocks examined per request.\n"
+            << "# TYPE allocator_request_blocks_scanned summary\n";
+        for (size_t i = 0; i < strategyMetrics.size(); ++i)
+            summary(strategyLabel(i), strategyMetrics[i].scanned, 1, "allocator_request_blocks_scanned");
+
+        out << "# HELP allocator_requests_total Requests by strategy and outcome.\n"
+            << "# TYPE allocator_requests_total counter\n";
+        for (size_t i = 0; i < strategyMetrics.size(); ++i) {
+            out << "allocator_requests_total{" << strategyLabel(i) << ",result=\"success\"} "
+                << strategyMetrics[i].successes << "\n"
+                << "allocator_requests_total{" << strategyLabel(i) << ",result=\"failure\"} "
+                << strategyMetrics[i].failures << "\n";
+        }
+
+        out << "# HELP allocator_release_latency_seconds release latency.\n"
+            << "# TYPE allocator_release_latency_seconds summary\n";
+        summary("", releaseLatency, 1e-9, "allocator_release_latency_seconds");
+        out << "# HELP allocator_compact_latency_seconds Full compaction latency.\n"
+            << "# TYPE allocator_compact_latency_seconds summary\n";
+        summary("", compactLatency, 1e-9, "allocator_compact_latency_seconds");
+#endif
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    // The one switch on the strategy letter; everything after it is specialised per strategy
+    bool serveRequest(ProcessHandle process, Address size, char strategy, Address alignment) {
+        switch (std::toupper(strategy)) {
+            case 'F': return processRequestWith<FirstFit>(process, size, alignment);
+            case 'B': return processRequestWith<BestFit>(process, size, alignment);
+            case 'W': return processRequestWith<WorstFit>(process, size, alignment);
+            case 'N': return processRequestWith<NextFit>(process, size, alignment);
+            case 'S': return processRequestWith<SegregatedFit>(process, size, alignment);
+            default:
+                std::cerr << "Error: Unknown strategy '" << static_cast<char>(std::toupper(strategy)) << "'\n";
+                return false;
+        }
+    }
+
+public:
+    // Runs a batch with coalescing deferred to a single pass at the end, or to the first
+    // allocation that misses; in deferred-coalescing mode the threshold still decides. Each
+    // run of consecutive allocations is placed largest first to limit fragmentation; releases
+    // keep their position. Results come back in request order.
+    std::vector<bool> processRequests(const Request* requests, size_t count) {
+        std::vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        for (size_t runStart = 0; runStart < count;) {
+            size_t runEnd = runStart;
+            while (runEnd < count && requests[runEnd].kind == Request::Allocate) ++runEnd;
+            std::stable_sort(order.begin() + runStart, order.begin() + runEnd, [&](size_t a, size_t b) {
+                return requests[a].size > requests[b].size;
+            });
+            runStart = runEnd == runStart ? runEnd + 1 : runEnd;
+        }
+
+        std::vector<bool> results(count);
+        deferCoalescing = true;
+        for (size_t i : order) {
+            const Request& request = requests[i];
+            results[i] = request.kind == Request::Allocate
+                             ? processRequest(request.process, request.size, request.strategy, request.alignment)
+                             : release(request.process);
+        }
+        deferCoalescing = coalesceThreshold > 0;
+        if (!deferCoalescing) coalescePending();
+        return results;
+    }
+
+    std::vector<bool> processRequests(const std::vector<Request>& requests) {
+        return processRequests(requests.data(), requests.size());
+    }
+};
+
+using MemoryAllocator = BasicMemoryAllocator<int>;
+using MemoryAllocator64 = BasicMemoryAllocator<std::int64_t>;
+
+// Power-of-two buddy engine: blocks split in halves and merge with the buddy found by XOR-ing the
+// address with the block size. A heap that is not a power of two is covered by one root per set
+// bit of its size, largest first, so every block stays aligned to its own size.
+class BuddyAllocator : public AllocatorEngine {
+private:
+    struct Allocation {
+        int order;
+        int requested;
+        ProcessHandle process;
+    };
+
+    int maxMemory;
+    int maxOrder;
+    // freeBits[k] has bit (address >> k) set while a free block of order k starts at address
+    std::vector<std::vector<std::uint64_t>> freeBits;
+    // Candidate free blocks per order; entries go stale on merge and are checked against freeBits
+    std::vector<std::vector<int>> freeLists;
+    std::map<int, Allocation> allocations;
+    std::unordered_map<ProcessHandle, std::vector<int>> blocksByProcess;
+    ProcessTable processes;
+
+    static int orderFor(int size) {
+        int order = highestSetBit(static_cast<std::uint32_t>(size));
+        return (size & (size - 1)) ? order + 1 : order;
+    }
+
+    bool isFreeBlock(int address, int order) const {
+        size_t bit = static_cast<size_t>(address) >> order;
+        const std::vector<std::uint64_t>& bits = freeBits[order];
+        return bit / 64 < bits.size() && (bits[bit / 64] >> (bit % 64) & 1);
+    }
+
+    void setFreeBit(int address, int order, bool free) {
+        size_t bit = static_cast<size_t>(address) >> order;
+        std::uint64_t mask = std::uint64_t(1) << (bit % 64);
+        if (free) freeBits[order][bit / 64] |= mask;
+        else freeBits[order][bit / 64] &= ~mask;
+    }
+
+    void pushFree(int address, int order) {
+        setFreeBit(address, order, true);
+        freeLists[order].push_back(address);
+    }
+
+    // Start of a free block of exactly `order`, or -1
+    int popFree(int order) {
+        std::vector<int>& list = freeLists[order];
+        while (!list.empty()) {
+            int address = list.back();
+            list.pop_back();
+            if (isFreeBlock(address, order)) {
+                setFreeBit(address, order, false);
+                return address;
+            }
+        }
+        return -1;
+    }
+
+    void reset() {
+        freeBits.assign(maxOrder + 1, {});
+        freeLists.assign(maxOrder + 1, {});
+        for (int order = 0; order <= maxOrder; ++order)
+            freeBits[order].assign((static_cast<size_t>(maxMemory) >> order) / 64 + 1, 0);
+
+        allocations.clear();
+        blocksByProcess.clear();
+
+        int address = 0;
+        for (int order = maxOrder; order >= 0; --order) {
+            if (maxMemory & (1 << order)) {
+                pushFree(address, order);
+                address += 1 << order;
+            }
+        }
+    }
+
+    void freeBlock(int address, int order) {
+        while (order < maxOrder) {
+            int buddy = address ^ (1 << order);
+            if (!isFreeBlock(buddy, order)) break;
+
+            setFreeBit(buddy, order, false);
+            address = std::min(address, buddy);
+            ++order;
+        }
+        pushFree(address, order);
+    }
+
+public:
+    explicit BuddyAllocator(int size)
+        : maxMemory(size), maxOrder(size > 0 ? highestSetBit(static_cast<std::uint32_t>(size)) : 0) {
+        reset();
+    }
+
+    bool allocate(ProcessHandle process, int size) {
+        if (process == kFreeProcess || size <= 0 || size > maxMemory) return false;
+
+        int order = orderFor(size);
+        int found = order;
+        int address = -1;
+        for (; found <= maxOrder && address < 0; ++found) address = popFree(found);
+        if (address < 0) return false;
+
+        // Split down to the requested order, returning each upper half to its free list
+        for (--found; found > order; --found) pushFree(address + (1 << (found - 1)), found - 1);
+
+        allocations[address] = {order, size, process};
+        blocksByProcess[process].push_back(address);
+        return true;
+    }
+
+    bool release(ProcessHandle process) {
+        auto owned = blocksByProcess.find(process);
+        if (owned == blocksByProcess.end()) return false;
+
+        for (int address : owned->second) {
+            auto it = allocations.find(address);
+            int order = it->second.order;
+            allocations.erase(it);
+            freeBlock(address, order);
+        }
+        blocksByProcess.erase(owned);
+        return true;
+    }
+
+    bool processRequest(const std::string& process, int size, char /*strategy*/) override {
+        return allocate(processes.intern(process), size);
+    }
+
+    bool release(const std::string& process) override {
+        ProcessHandle handle = processes.find(process);
+        return handle != kFreeProcess && release(handle);
+    }
+
+    // Buddy blocks cannot slide, so compaction re-places every live block largest first,
+    // which packs them without leaving split holes between them
+    void compact() override {
+        std::vector<Allocation> live;
+        for (const auto& entry : allocations) live.push_back(entry.second);
+        std::stable_sort(live.begin(), live.end(), [](const Allocation& a, const Allocation& b) {
+            return a.order > b.order;
+        });
+
+        reset();
+        for (const Allocation& allocation : live) allocate(allocation.process, allocation.requested);
+    }
+
+    void printStatus() const override {
+        std::cout << "\nMemory Status:\n";
+        int address = 0;
+        while (address < maxMemory) {
+            int order = -1;
+            auto it = allocations.find(address);
+            if (it != allocations.end()) {
+                order = it->second.order;
+                std::cout << "Addresses [" << address << ":" << address + (1 << order) - 1 << "] Process "
+                          << processes.name(it->second.process) << " | Size: " << (1 << order)
+                          << " | Requested: " << it->second.requested << "\n";
+            } else {
+                for (int k = maxOrder; k >= 0 && order < 0; --k)
+                    if (isFreeBlock(address, k)) order = k;
+                if (order < 0) break;
+                std::cout << "Addresses [" << address << ":" << address + (1 << order) - 1
+                          << "] Unused | Size: " << (1 << order) << "\n";
+            }
+            address += 1 << order;
+        }
+        std::cout << "\n";
+    }
+};
+
+// Bitmap engine for heaps split into fixed-size granules: one bit per granule (set when
+// allocated) instead of a node per block. First-fit finds a run of free bits with whole-word
+// checks and trailing-zero counts, skipping fully allocated words four at a time with AVX2
+// where the target supports it. Every strategy is served as first-fit.
+class BitmapAllocator : public AllocatorEngine {
+private:
+    struct Allocation {
+        int granules;
+        ProcessHandle process;
+    };
+
+    int maxMemory;
+    int granularity;
+    int granuleCount;
+    std::vector<std::uint64_t> bits;
+    std::unordered_map<int, Allocation> allocations;  // by first granule
+    std::unordered_map<ProcessHandle, std::vector<int>> blocksByProcess;
+    ProcessTable processes;
+
+    static constexpr std::uint64_t kAllSet = ~std::uint64_t(0);
+
+    // Bits past the last granule read as allocated so runs never extend beyond the heap
+    std::uint64_t usedWord(size_t word) const {
+        std::uint64_t value = bits[word];
+        int tail = granuleCount - static_cast<int>(word * 64);
+        if (tail < 64) value |= kAllSet << tail;
+        return value;
+    }
+
+    void setRange(int first, int count, bool used) {
+        while (count > 0) {
+            int offset = first % 64;
+            int take = std::min(count, 64 - offset);
+            std::uint64_t mask = (take == 64 ? kAllSet : ((std::uint64_t(1) << take) - 1)) << offset;
+            if (used) bits[first / 64] |= mask;
+            else bits[first / 64] &= ~mask;
+            first += take;
+            count -= take;
+        }
+    }
+
+    // First granule of the lowest run of `count` free granules, or -1
+    int findRun(int count) const {
+        int runStart = 0;
+        int runLength = 0;
+        size_t words = bits.size();
+
+        for (size_t word = 0; word < words; ++word) {
+#if defined(__AVX2__)
+            if (runLength == 0) {
+                const __m256i ones = _mm256_set1_epi64x(-1);
+                while (word + 4 < words &&
+                       _mm256_testc_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&bits[word])), ones))
+                    word += 4;
+                runStart = static_cast<int>(word) * 64;
+            }
+#endif
+            std::uint64_t used = usedWord(word);
+            if (used == 0) {
+                runLength += 64;
+                if (runLength >= count) return runStart;
+                continue;
+            }
+            if (used == kAllSet) {
+                runLength = 0;
+                runStart = static_cast<int>(word + 1) * 64;
+                continue;
+            }
+
+            int pos = 0;
+            while (pos < 64) {
+                std::uint64_t rest = used >> pos;
+                int freeBits = rest == 0 ? 64 - pos : lowestSetBit64(rest);
+                runLength += freeBits;
+                if (runLength >= count) return runStart;
+                pos += freeBits;
+                if (pos >= 64) break;
+
+                std::uint64_t freeRest = ~used >> pos;
+                int usedBits = freeRest == 0 ? 64 - pos : lowestSetBit64(freeRest);
+                pos += usedBits;
+                runStart = static_cast<int>(word) * 64 + pos;
+                runLength = 0;
+            }
+        }
+        return -1;
+    }
+
+public:
+    BitmapAllocator(int size, int granuleSize)
+        : maxMemory(size), granularity(std::max(1, granuleSize)), granuleCount(size / std::max(1, granuleSize)),
+          bits((granuleCount + 63) / 64, 0) {}
+
+    bool allocate(ProcessHandle process, int size) {
+        if (process == kFreeProcess || size <= 0) return false;
+
+        int granules = (size + granularity - 1) / granularity;
+        if (granules > granuleCount) return false;
+        int first = findRun(granules);
+        if (first < 0) return false;
+
+        setRange(first, granules, true);
+        allocations[first] = {granules, process};
+        blocksByProcess[process].push_back(first);
+        return true;
+    }
+
+    bool release(ProcessHandle process) {
+        auto owned = blocksByProcess.find(process);
+        if (owned == blocksByProcess.end()) return false;
+
+        for (int first : owned->second) {
+            auto it = allocations.find(first);
+            setRange(first, it->second.granules, false);
+            allocations.erase(it);
+        }
+        blocksByProcess.erase(owned);
+        return true;
+    }
+
+    bool processRequest(const std::string& process, int size, char /*strategy*/) override {
+        return allocate(processes.intern(process), size);
+    }
+
+    bool release(const std::string& process) override {
+        ProcessHandle handle = processes.find(process);
+        return handle != kFreeProcess && release(handle);
+    }
+
+    void compact() override {
+        std::vector<std::pair<int, Allocation>> live(allocations.begin(), allocations.end());
+        std::sort(live.begin(), live.end(),
+                  [](const std::pair<int, Allocation>& a, const std::pair<int, Allocation>& b) { return a.first < b.first; });
+
+        std::fill(bits.begin(), bits.end(), 0);
+        allocations.clear();
+        blocksByProcess.clear();
+
+        int next = 0;
+        for (const auto& entry : live) {
+            setRange(next, entry.second.granules, true);
+            allocations[next] = entry.second;
+            blocksByProcess[entry.second.process].push_back(next);
+            next += entry.second.granules;
+        }
+    }
+
+    const std::string& processName(ProcessHandle process) const {
+        return processes.name(process);
+    }
+
+    // Visits the managed addresses in order as blocks: each allocation, and each run of free
+    // granules between them as one free block
+    template <typename Visitor>
+    void forEachBlock(Visitor visit) const {
+        std::vector<int> starts;
+        for (const auto& entry : allocations) starts.push_back(entry.first);
+        std::sort(starts.begin(), starts.end());
+
+        int next = 0;
+        auto visitFree = [&](int from, int to) {
+            if (from < to) visit(MemoryBlock(from * granularity, to * granularity - 1));
+        };
+        for (int first : starts) {
+            const Allocation& allocation = allocations.at(first);
+            visitFree(next, first);
+            visit(MemoryBlock(first * granularity, (first + allocation.granules) * granularity - 1, allocation.process));
+            next = first + allocation.granules;
+        }
+        visitFree(next, granuleCount);
+    }
+
+    void printStatus() const override {
+        std::cout << "\nMemory Status:\n";
+        forEachBlock([&](const MemoryBlock& block) {
+            std::string status = block.isFree() ? "Unused" : "Process " + processes.name(block.process);
+            std::cout << "Addresses [" << block.start << ":" << block.end << "] " << status
+                      << " | Size: " << block.size() << "\n";
+        });
+        if (granuleCount * granularity < maxMemory)
+            std::cout << "Addresses [" << granuleCount * granularity << ":" << maxMemory - 1
+                      << "] Unmanaged | Size: " << maxMemory - granuleCount * granularity << "\n";
+        std::cout << "\n";
+    }
+};
+
+// Thread-safe engine that splits the address space into arenas, each a MemoryAllocator behind
+// its own mutex. A thread allocates from its home arena and spills over to the siblings in
+// ring order; releasing a single block is routed to the owning arena by its address.
+class ConcurrentAllocator : public AllocatorEngine {
+private:
+    struct Arena {
+        std::mutex lock;
+        MemoryAllocator allocator;
+        int base;
+
+        Arena(int b, int size) : allocator(size), base(b) {}
+    };
+
+    int maxMemory;
+    int arenaSize;
+    std::vector<std::unique_ptr<Arena>> arenas;
+    std::atomic<bool> snapshotsEnabled{false};
+
+    size_t homeArena() const {
+        static std::atomic<unsigned> nextHome{0};
+        thread_local unsigned home = nextHome++;
+        return home % arenas.size();
+    }
+
+    size_t arenaOf(int address) const {
+        return std::min(static_cast<size_t>(address / arenaSize), arenas.size() - 1);
+    }
 
-class MemoryBlock {
 public:
-    int start, end;
-    std::string process;
+    ConcurrentAllocator(int size, int arenaCount)
+        : maxMemory(size), arenaSize(std::max(1, size / std::max(1, arenaCount))) {
+        for (int base = 0; base < size; base += arenaSize) {
+            // The last arena absorbs the remainder of an uneven split
+            int length = size - base < 2 * arenaSize ? size - base : arenaSize;
+            arenas.push_back(std::make_unique<Arena>(base, length));
+            if (length != arenaSize) break;
+        }
+    }
+
+    // Start address of the new block, or -1 when no arena can hold it
+    int allocate(const std::string& process, int size, char strategy) {
+        size_t home = homeArena();
+        for (size_t i = 0; i < arenas.size(); ++i) {
+            Arena& arena = *arenas[(home + i) % arenas.size()];
+            std::lock_guard<std::mutex> guard(arena.lock);
+            int start = arena.allocator.allocate(arena.allocator.internProcess(process), size, strategy);
+            if (start >= 0) {
+                arena.allocator.publishSnapshot();
+                return arena.base + start;
+            }
+        }
+        return -1;
+    }
+
+    bool releaseAt(int address) {
+        if (address < 0 || address >= maxMemory) return false;
+        Arena& arena = *arenas[arenaOf(address)];
+        std::lock_guard<std::mutex> guard(arena.lock);
+        bool released = arena.allocator.releaseBlock(address - arena.base);
+        arena.allocator.publishSnapshot();
+        return released;
+    }
+
+    bool processRequest(const std::string& process, int size, char strategy) override {
+        return allocate(process, size, strategy) >= 0;
+    }
+
+    // A process may own blocks in several arenas
+    bool release(const std::string& process) override {
+        bool found = false;
+        for (auto& arena : arenas) {
+            std::lock_guard<std::mutex> guard(arena->lock);
+            found = arena->allocator.release(process) || found;
+            arena->allocator.publishSnapshot();
+        }
+        return found;
+    }
+
+    // Compacts each arena in place; blocks never move between arenas
+    void compact() override {
+        for (auto& arena : arenas) {
+            std::lock_guard<std::mutex> guard(arena->lock);
+            arena->allocator.compact();
+            arena->allocator.publishSnapshot();
+        }
+    }
+
+    // compact(), also recording the old and new start of every block that moved. Compaction
+    // keeps blocks in address order, so the allocated starts before and after pair up.
+    void compact(std::unordered_map<int, int>& moved) {
+        for (auto& arena : arenas) {
+            std::lock_guard<std::mutex> guard(arena->lock);
+            std::vector<int> before, after;
+            arena->allocator.forEachBlock([&](const MemoryBlock& block) {
+                if (!block.isFree()) before.push_back(arena->base + block.start);
+            });
+            arena->allocator.compact();
+            arena->allocator.publishSnapshot();
+            arena->allocator.forEachBlock([&](const MemoryBlock& block) {
+                if (!block.isFree()) after.push_back(arena->base + block.start);
+            });
+            for (size_t i = 0; i < before.size(); ++i)
+                if (before[i] != after[i]) moved.emplace(before[i], after[i]);
+        }
+    }
+
+    // Arenas publish a snapshot after every change, so monitoring never takes their locks
+    void enableSnapshots(int chunkSpan) {
+        for (auto& arena : arenas) {
+            std::lock_guard<std::mutex> guard(arena->lock);
+            arena->allocator.enableSnapshots(chunkSpan);
+        }
+        snapshotsEnabled = true;
+    }
+
+    // Per-arena snapshots with their base addresses, taken without locking. Each arena's view
+    // is consistent on its own; arenas may be at slightly different points in time.
+    std::vector<std::pair<int, std::shared_ptr<const HeapSnapshot>>> snapshots() const {
+        std::vector<std::pair<int, std::shared_ptr<const HeapSnapshot>>> result;
+        for (const auto& arena : arenas) result.emplace_back(arena->base, arena->allocator.snapshot());
+        return result;
+    }
+
+    void printStatus() const override {
+        std::cout << "\nMemory Status:\n";
+        if (snapshotsEnabled) {
+            auto views = snapshots();
+            for (size_t i = 0; i < views.size(); ++i) {
+                std::cout << "Arena " << i << " (snapshot " << views[i].second->version << ", "
+                          << views[i].second->usedUnits << " used / " << views[i].second->freeUnits << " free):\n";
+                views[i].second->print(views[i].first);
+            }
+            std::cout << "\n";
+            return;
+        }
+
+        for (size_t i = 0; i < arenas.size(); ++i) {
+            Arena& arena = *arenas[i];
+            std::lock_guard<std::mutex> guard(arena.lock);
+            std::cout << "Arena " << i << ":\n";
+            arena.allocator.forEachBlock([&](const MemoryBlock& block) {
+                std::string status = block.isFree() ? "Unused" : "Process " + arena.allocator.processName(block.process);
+                std::cout << "Addresses [" << arena.base + block.start << ":" << arena.base + block.end << "] "
+                          << status << " | Size: " << block.size() << "\n";
+            });
+        }
+        std::cout << "\n";
+    }
+};
+
+// Engine for machines with several NUMA nodes or memory tiers: one MemoryAllocator pool per
+// node, each over its own address range. A request is served from the caller's local node if
+// it can be, else from the other pools nearest first, by a distance matrix in the units of
+// the ACPI SLIT (10 is local). Counts of local and remote placements show what locality cost.
+class PooledAllocator : public AllocatorEngine {
+private:
+    struct Pool {
+        MemoryAllocator allocator;
+        int base;
+        long long localAllocations = 0;
+        long long remoteAllocations = 0;  // placed here for a caller on another node
+
+        Pool(int b, int size) : allocator(size), base(b) {}
+    };
+
+    int maxMemory;
+    std::vector<Pool> pools;
+    std::vector<std::vector<int>> distance;
+    std::vector<std::vector<size_t>> fallbackOrder;  // per node, every pool by distance
+    size_t localNode = 0;
+
+    void orderFallbacks() {
+        fallbackOrder.assign(pools.size(), {});
+        for (size_t node = 0; node < pools.size(); ++node) {
+            std::vector<size_t>& order = fallbackOrder[node];
+            for (size_t pool = 0; pool < pools.size(); ++pool) order.push_back(pool);
+            // Ties go to the pool closer in index, so equally distant nodes are not all
+            // drained from pool 0 first
+            auto ring = [&](size_t pool) { return (pool + pools.size() - node) % pools.size(); };
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return distance[node][a] != distance[node][b] ? distance[node][a] < distance[node][b]
+                                                              : ring(a) < ring(b);
+            });
+        }
+    }
+
+    size_t poolOf(int address) const {
+        size_t pool = 0;
+        while (pool + 1 < pools.size() && pools[pool + 1].base <= address) ++pool;
+        return pool;
+    }
+
+public:
+    // Splits `size` evenly over `nodes` pools, the last taking the remainder. `distances`, if
+    // it is nodes x nodes, gives node-to-node distances; otherwise each step away in node
+    // order adds 10, which fits both a two-socket box and a chain of slower tiers.
+    PooledAllocator(int size, int nodes, const std::vector<std::vector<int>>& distances = {})
+        : maxMemory(size) {
+        int count = std::max(1, std::min(nodes, size));
+        int poolSize = size / count;
+        pools.reserve(count);
+        for (int node = 0; node < count; ++node)
+            pools.emplace_back(node * poolSize, node + 1 < count ? poolSize : size - node * poolSize);
+
+        bool usable = distances.size() == pools.size();
+        for (const auto& row : distances) usable = usable && row.size() == pools.size();
+        distance.assign(pools.size(), std::vector<int>(pools.size()));
+        for (size_t from = 0; from < pools.size(); ++from)
+            for (size_t to = 0; to < pools.size(); ++to)
+                distance[from][to] = usable ? distances[from][to]
+                                            : 10 + 10 * static_cast<int>(from > to ? from - to : to - from);
+        orderFallbacks();
+    }
+
+    // The machine's node distances from /sys/devices/system/node, or empty where there is none
+    static std::vector<std::vector<int>> systemDistances() {
+        std::vector<std::vector<int>> rows;
+        for (int node = 0;; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/distance");
+            std::vector<int> row;
+            for (int value; file >> value;) row.push_back(value);
+            if (row.empty()) break;
+            rows.push_back(std::move(row));
+        }
+        return rows;
+    }
+
+    size_t poolCount() const {
+        return pools.size();
+    }
+
+    // Node whose pool processRequest tries first
+    bool setLocalNode(size_t node) {
+        if (node >= pools.size()) return false;
+        localNode = node;
+        return true;
+    }
+
+    bool setDistance(size_t from, size_t to, int value) {
+        if (from >= pools.size() || to >= pools.size() || value <= 0) return false;
+        distance[from][to] = value;
+        orderFallbacks();
+        return true;
+    }
+
+    // Start address of the new block, or -1 when no pool can hold it
+    int allocate(const std::string& process, int size, char strategy, size_t node) {
+        if (node >= pools.size()) return -1;
+        for (size_t index : fallbackOrder[node]) {
+            Pool& pool = pools[index];
+            int start = pool.allocator.allocate(pool.allocator.internProcess(process), size, strategy);
+            if (start >= 0) {
+                ++(index == node ? pool.localAllocations : pool.remoteAllocations);
+                return pool.base + start;
+            }
+        }
+        return -1;
+    }
+
+    bool releaseAt(int address) {
+        if (address < 0 || address >= maxMemory) return false;
+        Pool& pool = pools[poolOf(address)];
+        return pool.allocator.releaseBlock(address - pool.base);
+    }
+
+    bool processRequest(const std::string& process, int size, char strategy) override {
+        return allocate(process, size, strategy, localNode) >= 0;
+    }
+
+    // A process may own blocks in several pools
+    bool release(const std::string& process) override {
+        bool found = false;
+        for (Pool& pool : pools) found = pool.allocator.release(process) || found;
+        return found;
+    }
+
+    // Compacts each pool in place; blocks never move between nodes
+    void compact() override {
+        for (Pool& pool : pools) pool.allocator.compact();
+    }
+
+    // One line per pool: its range, occupancy and where its blocks were asked for
+    void printSummary() const {
+        std::cout << "\nPools:\n";
+        for (size_t i = 0; i < pools.size(); ++i) {
+            const Pool& pool = pools[i];
+            MemoryAllocator::Stats stats = pool.allocator.stats();
+            long long size = stats.usedUnits + stats.freeUnits;
+            std::cout << "Pool " << i << (i == localNode ? " (local)" : "") << " [" << pool.base << ":"
+                      << pool.base + size - 1 << "] | Used: " << stats.usedUnits << " / " << size << " ("
+                      << std::fixed << std::setprecision(1) << 100.0 * stats.usedUnits / size
+                      << "%) | Largest free: " << stats.largestFree << " | Local allocations: "
+                      << pool.localAllocations << " | Remote allocations: " << pool.remoteAllocations << "\n";
+        }
+        std::cout << "\n";
+    }
+
+    void printStatus() const override {
+        printSummary();
+        std::cout << "Memory Status:\n";
+        for (size_t i = 0; i < pools.size(); ++i) {
+            const Pool& pool = pools[i];
+            std::cout << "Pool " << i << ":\n";
+            pool.allocator.forEachBlock([&](const MemoryBlock& block) {
+                std::string status = block.isFree() ? "Unused" : "Process " + pool.allocator.processName(block.process);
+                std::cout << "Addresses [" << pool.base + block.start << ":" << pool.base + block.end << "] "
+                          << status << " | Size: " << block.size() << "\n";
+            });
+        }
+        std::cout << "\n";
+    }
+};
+
+// Lock-free cache of fixed-size blocks in front of a ConcurrentAllocator. Each cached size has
+// a Treiber stack of free slots; a hit pops a slot without touching any arena or its lock.
+// Misses carve a block from the arenas, owned there by the kOwner process, and releases
+// store it back in the stack, so cached blocks stay allocated as far as the arenas can tell.
+class SmallBlockCache {
+public:
+    struct Counters {
+        int size;
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t cachedReleases;
+        std::uint64_t overflowReleases;
+    };
+
+private:
+    static constexpr std::uint32_t kNil = 0;
+
+    // Holds a space, so no client named by a driver command or trace can release these blocks
+    static constexpr const char* kOwner = "small-block cache";
+
+    // Nodes are addressed by index + 1 so that 0 can mean an empty stack
+    struct Node {
+        std::atomic<int> address{-1};
+        std::atomic<std::uint32_t> next{kNil};
+    };
+
+    // Head word is (tag << 32 | node), and every successful push or pop bumps the tag so a
+    // stale compare-and-swap cannot succeed after the same node has been popped and pushed
+    class TaggedStack {
+    private:
+        std::atomic<std::uint64_t> head{kNil};
+
+    public:
+        void push(std::vector<Node>& nodes, std::uint32_t node) {
+            std::uint64_t old = head.load(std::memory_order_relaxed);
+            std::uint64_t desired;
+            do {
+                nodes[node - 1].next.store(static_cast<std::uint32_t>(old), std::memory_order_relaxed);
+                desired = ((old >> 32) + 1) << 32 | node;
+            } while (!head.compare_exchange_weak(old, desired, std::memory_order_release,
+                                                 std::memory_order_relaxed));
+        }
+
+        std::uint32_t pop(std::vector<Node>& nodes) {
+            std::uint64_t old = head.load(std::memory_order_acquire);
+            std::uint64_t desired;
+            do {
+                std::uint32_t node = static_cast<std::uint32_t>(old);
+                if (node == kNil) return kNil;
+                std::uint32_t next = nodes[node - 1].next.load(std::memory_order_relaxed);
+                desired = ((old >> 32) + 1) << 32 | next;
+            } while (!head.compare_exchange_weak(old, desired, std::memory_order_acquire,
+                                                 std::memory_order_acquire));
+            return static_cast<std::uint32_t>(old);
+        }
+    };
+
+    // One cached size: `slots` holds nodes with a cached block, `spare` the unused nodes
+    struct SizeClass {
+        int size;
+        std::vector<Node> nodes;
+        TaggedStack slots;
+        TaggedStack spare;
+        std::atomic<std::uint64_t> hits{0};
+        std::atomic<std::uint64_t> misses{0};
+        std::atomic<std::uint64_t> cachedReleases{0};
+        std::atomic<std::uint64_t> overflowReleases{0};
+
+        SizeClass(int s, size_t capacity) : size(s), nodes(capacity) {}
+    };
+
+    ConcurrentAllocator& backing;
+    std::vector<std::unique_ptr<SizeClass>> classes;
+
+    // Smallest cached size that holds `size`, or nullptr
+    SizeClass* classFor(int size) const {
+        for (const auto& cls : classes)
+            if (cls->size >= size) return cls.get();
+        return nullptr;
+    }
+
+public:
+    // `sizes` are the cached block sizes; each caches up to `slotsPerSize` free blocks
+    SmallBlockCache(ConcurrentAllocator& allocator, std::vector<int> sizes, size_t slotsPerSize)
+        : backing(allocator) {
+        std::sort(sizes.begin(), sizes.end());
+        sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+        for (int size : sizes) {
+            if (size <= 0) continue;
+            classes.push_back(std::make_unique<SizeClass>(size, slotsPerSize));
+            SizeClass& cls = *classes.back();
+            for (size_t i = cls.nodes.size(); i > 0; --i) cls.spare.push(cls.nodes, static_cast<std::uint32_t>(i));
+        }
+    }
+
+    // Start of a block of at least `size` units, or -1. Sizes above the largest cached size go
+    // straight to the arenas.
+    int allocate(int size) {
+        SizeClass* cls = classFor(size);
+        if (!cls) return backing.allocate(kOwner, size, 'F');
+
+        std::uint32_t node = cls->slots.pop(cls->nodes);
+        if (node != kNil) {
+            int address = cls->nodes[node - 1].address.load(std::memory_order_relaxed);
+            cls->spare.push(cls->nodes, node);
+            cls->hits.fetch_add(1, std::memory_order_relaxed);
+            return address;
+        }
+
+        cls->misses.fetch_add(1, std::memory_order_relaxed);
+        return backing.allocate(kOwner, cls->size, 'F');
+    }
+
+    // Return a block from allocate(); `size` must be the size it was requested with
+    void release(int address, int size) {
+        SizeClass* cls = classFor(size);
+        std::uint32_t node = cls ? cls->spare.pop(cls->nodes) : kNil;
+        if (node == kNil) {
+            if (cls) cls->overflowReleases.fetch_add(1, std::memory_order_relaxed);
+            backing.releaseAt(address);
+            return;
+        }
+
+        cls->nodes[node - 1].address.store(address, std::memory_order_relaxed);
+        cls->slots.push(cls->nodes, node);
+        cls->cachedReleases.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<Counters> counters() const {
+        std::vector<Counters> result;
+        for (const auto& cls : classes) {
+            result.push_back({cls->size, cls->hits.load(std::memory_order_relaxed),
+                              cls->misses.load(std::memory_order_relaxed),
+                              cls->cachedReleases.load(std::memory_order_relaxed),
+                              cls->overflowReleases.load(std::memory_order_relaxed)});
+        }
+        return result;
+    }
+
+    // Points cached blocks the arenas moved, old start to new, at their new place. Only while
+    // no other thread uses the cache.
+    void relocate(const std::unordered_map<int, int>& moved) {
+        for (auto& cls : classes) {
+            for (Node& node : cls->nodes) {
+                auto it = moved.find(node.address.load(std::memory_order_relaxed));
+                if (it != moved.end()) node.address.store(it->second, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // One line per cached size, as METRICS prints them
+    void printCounters(std::ostream& out) const {
+        for (const Counters& c : counters()) {
+            out << "cache_size=" << c.size << " hits=" << c.hits << " misses=" << c.misses
+                << " cached_releases=" << c.cachedReleases << " overflow_releases=" << c.overflowReleases << "\n";
+        }
+    }
+};
+
+// The sharded engine behind a SmallBlockCache, for the driver (--cache-sizes). Requests up to
+// the largest cached size go through the cache, whatever their strategy, and are remembered
+// per process so RL can hand them back to it; larger ones go straight to the arenas.
+class CachedAllocator : public AllocatorEngine {
+private:
+    ConcurrentAllocator backing;
+    SmallBlockCache cache;
+    int largestCached = 0;
+    std::unordered_map<std::string, std::vector<std::pair<int, int>>> cachedBlocks;  // (start, size)
+
+public:
+    static constexpr size_t kSlotsPerSize = 4096;
+
+    CachedAllocator(int size, int arenaCount, const std::vector<int>& sizes)
+        : backing(size, arenaCount), cache(backing, sizes, kSlotsPerSize) {
+        for (int cached : sizes) largestCached = std::max(largestCached, cached);
+    }
+
+    ConcurrentAllocator& arenas() {
+        return backing;
+    }
+
+    const SmallBlockCache& blockCache() const {
+        return cache;
+    }
+
+    bool processRequest(const std::string& process, int size, char strategy) override {
+        if (size <= 0 || size > largestCached) return backing.processRequest(process, size, strategy);
+        int start = cache.allocate(size);
+        if (start < 0) return false;
+        cachedBlocks[process].emplace_back(start, size);
+        return true;
+    }
+
+    bool release(const std::string& process) override {
+        bool found = false;
+        auto owned = cachedBlocks.find(process);
+        if (owned != cachedBlocks.end()) {
+            for (const auto& block : owned->second) cache.release(block.first, block.second);
+            cachedBlocks.erase(owned);
+            found = true;
+        }
+        return backing.release(process) || found;
+    }
+
+    // Compaction moves the blocks the cache holds too, so both it and the per-process lists
+    // follow them
+    void compact() override {
+        std::unordered_map<int, int> moved;
+        backing.compact(moved);
+        cache.relocate(moved);
+        for (auto& owned : cachedBlocks) {
+            for (auto& block : owned.second) {
+                auto it = moved.find(block.first);
+                if (it != moved.end()) block.first = it->second;
+            }
+        }
+    }
+
+    void printStatus() const override {
+        backing.printStatus();
+        std::cout << "Cache:\n";
+        cache.printCounters(std::cout);
+        std::cout << "\n";
+    }
+};
+
+// Microbenchmarks for the block allocator strategies (run with --bench). Each run fills a heap
+// sized for about 50% occupancy with `liveBlocks` blocks, then replaces one block per step,
+// releasing in LIFO or FIFO order, and times every allocate and release, with latency
+// percentiles reported for each operation.
+namespace bench {
+
+enum class SizeTrace { Uniform, Bimodal, PowerLaw };
+
+const char* traceName(SizeTrace trace) {
+    switch (trace) {
+        case SizeTrace::Uniform: return "uniform";
+        case SizeTrace::Bimodal: return "bimodal";
+        default: return "power-law";
+    }
+}
+
+int sampleSize(SizeTrace trace, std::mt19937& rng) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    switch (trace) {
+        case SizeTrace::Uniform:
+            return 1 + static_cast<int>(rng() % 64);
+        case SizeTrace::Bimodal:
+            return unit(rng) < 0.9 ? 1 + static_cast<int>(rng() % 16) : 256 + static_cast<int>(rng() % 769);
+        default:
+            // Pareto with alpha 1.5, capped so one request cannot swallow the heap
+            return std::min(4096, static_cast<int>(std::ceil(4.0 / std::pow(1.0 - unit(rng), 1.0 / 1.5))));
+    }
+}
+
+struct Result {
+    long long operations = 0;
+    long long failures = 0;
+    double seconds = 0;
+    std::vector<long long> allocateLatencies;
+    std::vector<long long> releaseLatencies;
+    double fragmentation = 0;
+    double compactMillis = 0;
+};
+
+long long percentile(std::vector<long long>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+}
+
+Result run(char strategy, SizeTrace trace, bool lifo, int liveBlocks, int steps) {
+    using Clock = std::chrono::steady_clock;
+    std::mt19937 rng(12345);
+
+    double meanSize = 0;
+    for (int i = 0; i < 10000; ++i) meanSize += sampleSize(trace, rng);
+    meanSize /= 10000;
+    long long heap = static_cast<long long>(2 * meanSize * liveBlocks);
+    MemoryAllocator allocator(static_cast<int>(std::min<long long>(heap, std::numeric_limits<int>::max())));
+
+    // One handle per live slot; a released handle is reused by the next allocation
+    std::vector<ProcessHandle> freeHandles;
+    for (int i = liveBlocks; i >= 0; --i) freeHandles.push_back(allocator.internProcess("p" + std::to_string(i)));
+    std::deque<ProcessHandle> live;
+
+    auto allocateOne = [&](Result* result) {
+        ProcessHandle handle = freeHandles.back();
+        int size = sampleSize(trace, rng);
+        auto begin = Clock::now();
+        bool ok = allocator.processRequest(handle, size, strategy);
+        auto end = Clock::now();
+        if (ok) {
+            freeHandles.pop_back();
+            live.push_back(handle);
+        }
+        if (result) {
+            result->allocateLatencies.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            result->failures += !ok;
+        }
+    };
+
+    while (static_cast<int>(live.size()) < liveBlocks) {
+        size_t before = live.size();
+        allocateOne(nullptr);
+        if (live.size() == before) break;
+    }
+
+    Result result;
+    result.allocateLatencies.reserve(static_cast<size_t>(steps));
+    result.releaseLatencies.reserve(static_cast<size_t>(steps));
+    auto begin = Clock::now();
+    for (int step = 0; step < steps && !live.empty(); ++step) {
+        ProcessHandle victim;
+        if (lifo) {
+            victim = live.back();
+            live.pop_back();
+        } else {
+            victim = live.front();
+            live.pop_front();
+        }
+        auto releaseBegin = Clock::now();
+        allocator.release(victim);
+        result.releaseLatencies.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - releaseBegin).count());
+        freeHandles.push_back(victim);
+
+        allocateOne(&result);
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    result.operations = static_cast<long long>(result.allocateLatencies.size() + result.releaseLatencies.size());
+
+    result.fragmentation = allocator.stats().externalFragmentation;
+
+    auto compactBegin = Clock::now();
+    allocator.compact();
+    result.compactMillis = std::chrono::duration<double, std::milli>(Clock::now() - compactBegin).count();
+    return result;
+}
+
+void runAll(const std::vector<int>& blockCounts, int steps) {
+    std::cout << "Latency percentiles in ns, RQ for allocations and RL for releases\n"
+              << std::left << std::setw(9) << "strategy" << std::setw(10) << "trace" << std::setw(9) << "lifetime"
+              << std::right << std::setw(10) << "blocks" << std::setw(13) << "ops/sec" << std::setw(9) << "RQ p50"
+              << std::setw(9) << "RQ p99" << std::setw(10) << "RQ p999" << std::setw(9) << "RL p50" << std::setw(9)
+              << "RL p99" << std::setw(10) << "RL p999" << std::setw(9) << "fail %" << std::setw(9) << "frag %"
+              << std::setw(13) << "compact ms" << "\n";
+
+    for (int liveBlocks : blockCounts) {
+        for (SizeTrace trace : {SizeTrace::Uniform, SizeTrace::Bimodal, SizeTrace::PowerLaw}) {
+            for (bool lifo : {true, false}) {
+                for (char strategy : {'F', 'B', 'W', 'N', 'S'}) {
+                    Result result = run(strategy, trace, lifo, liveBlocks, steps);
+                    std::cout << std::left << std::setw(9) << strategy << std::setw(10) << traceName(trace)
+                              << std::setw(9) << (lifo ? "LIFO" : "FIFO") << std::right << std::setw(10) << liveBlocks
+                              << std::setw(13) << std::fixed << std::setprecision(0)
+                              << (result.seconds > 0 ? result.operations / result.seconds : 0.0);
+                    for (std::vector<long long>* latencies : {&result.allocateLatencies, &result.releaseLatencies}) {
+                        std::sort(latencies->begin(), latencies->end());
+                        std::cout << std::setw(9) << percentile(*latencies, 0.50) << std::setw(9)
+                                  << percentile(*latencies, 0.99) << std::setw(10) << percentile(*latencies, 0.999);
+                    }
+                    std::cout << std::setprecision(1)
+                              << std::setw(9) << (steps ? 100.0 * result.failures / steps : 0.0)
+                              << std::setw(9) << 100.0 * result.fragmentation
+                              << std::setw(13) << std::setprecision(2) << result.compactMillis << std::endl;
+                }
+            }
+        }
+    }
+}
+
+}  // namespace bench
+
+// Differential stress testing: one operation stream drives a reference model and the block,
+// blocks64 and bitmap engines, and every result and block map must match the model after each
+// step. The stream comes from seeds (--stress) or from fuzzer input (LLVMFuzzerTestOneInput).
+// --stress then hammers the sharded engine and its lock-free cache from several threads.
+// Run it from a -mavx2 build too: only that build takes BitmapAllocator::findRun's vector path.
+namespace stress {
+
+// The original allocator, kept as the model: blocks in a vector sorted by start, linear
+// first-, best- and worst-fit scans, a full merge pass on release and compaction by sliding
+class ReferenceAllocator {
+public:
+    struct Block {
+        int start, end;
+        std::string process;
+
+        int size() const {
+            return end - start + 1;
+        }
+
+        bool isFree() const {
+            return process.empty();
+        }
+
+        bool operator==(const Block& other) const {
+            return start == other.start && end == other.end && process == other.process;
+        }
+    };
+
+private:
+    int maxMemory;
+    std::vector<Block> blocks;
+
+    void sortBlocks() {
+        std::sort(blocks.begin(), blocks.end(), [](const Block& a, const Block& b) { return a.start < b.start; });
+    }
+
+    // Takes `size` units from the front of free block `index` for `process`
+    void carve(size_t index, const std::string& process, int size) {
+        int start = blocks[index].start;
+        if (blocks[index].size() > size) blocks[index].start = start + size;
+        else blocks.erase(blocks.begin() + static_cast<std::ptrdiff_t>(index));
+        blocks.push_back({start, start + size - 1, process});
+        sortBlocks();
+    }
+
+    void mergeAdjacentFreeBlocks() {
+        for (size_t i = 0; i + 1 < blocks.size();) {
+            if (blocks[i].isFree() && blocks[i + 1].isFree()) {
+                blocks[i].end = blocks[i + 1].end;
+                blocks.erase(blocks.begin() + static_cast<std::ptrdiff_t>(i) + 1);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+public:
+    explicit ReferenceAllocator(int size) : maxMemory(size) {
+        blocks.push_back({0, size - 1, ""});
+    }
+
+    const std::vector<Block>& blockList() const {
+        return blocks;
+    }
+
+    // 'F', 'B' or 'W'; ties go to the lowest address
+    bool allocate(const std::string& process, int size, char strategy) {
+        size_t chosen = blocks.size();
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (!blocks[i].isFree() || blocks[i].size() < size) continue;
+            if (chosen == blocks.size() || (strategy == 'B' && blocks[i].size() < blocks[chosen].size()) ||
+                (strategy == 'W' && blocks[i].size() > blocks[chosen].size()))
+                chosen = i;
+            if (strategy == 'F') break;
+        }
+        if (chosen == blocks.size()) return false;
+        carve(chosen, process, size);
+        return true;
+    }
+
+    bool release(const std::string& process) {
+        bool found = false;
+        for (Block& block : blocks) {
+            if (block.process == process) {
+                block.process.clear();
+                found = true;
+            }
+        }
+        if (found) mergeAdjacentFreeBlocks();
+        return found;
+    }
+
+    void compact() {
+        std::vector<Block> packed;
+        int next = 0;
+        for (const Block& block : blocks) {
+            if (block.isFree()) continue;
+            packed.push_back({next, next + block.size() - 1, block.process});
+            next += block.size();
+        }
+        if (next < maxMemory) packed.push_back({next, maxMemory - 1, ""});
+        blocks = std::move(packed);
+    }
+};
+
+using BlockMap = std::vector<ReferenceAllocator::Block>;
 
-    MemoryBlock(int s, int e, const std::string& p = "") : start(s), end(e), process(p) {}
+// Any engine with forEachBlock and processName, in the model's terms
+template <typename Engine>
+BlockMap blockMapOf(const Engine& engine) {
+    BlockMap map;
+    engine.forEachBlock([&](const auto& block) {
+        map.push_back({static_cast<int>(block.start), static_cast<int>(block.end),
+                       block.isFree() ? std::string() : std::string(engine.processName(block.process))});
+    });
+    return map;
+}
 
-    int size() const {
-        return end - start + 1;
-    }
+// What the model cannot check about a block engine: the blocks tile the heap, no two free
+// blocks are adjacent once no merges are pending, the incremental stats() counters match a
+// rescan and each process's usage is the units it owns. Returns the first violation, or an
+// empty string.
+template <typename Allocator>
+std::string invariantViolation(const Allocator& allocator) {
+    std::string problem;
+    auto fail = [&](const std::string& what) {
+        if (problem.empty()) problem = what;
+    };
+    bool pending = allocator.coalescingPending(), previousFree = false;
+    long long previousEnd = -1, freeUnits = 0, largestFree = 0;
+    size_t freeBlocks = 0, usedBlocks = 0;
+    std::vector<long long> owned(allocator.processNames().size());
+    allocator.forEachBlock([&](const auto& block) {
+        std::string at = std::to_string(previousEnd) + "|" + std::to_string(block.start);
+        if (block.start != previousEnd + 1) fail("has a gap or overlap at " + at);
+        if (!pending && previousFree && block.isFree()) fail("left free blocks unmerged at " + at);
+        if (block.isFree()) {
+            ++freeBlocks;
+            freeUnits += block.size();
+            largestFree = std::max<long long>(largestFree, block.size());
+        } else {
+            ++usedBlocks;
+            owned[block.process] += block.size();
+        }
+        previousFree = block.isFree();
+        previousEnd = block.end;
+    });
+    if (previousEnd + 1 != allocator.capacity()) fail("ends its blocks at " + std::to_string(previousEnd));
 
-    bool isFree() const {
-        return process.empty();
+    auto stats = allocator.stats();
+    auto describe = [](long long units, size_t count, long long largest) {
+        return std::to_string(units) + " free units in " + std::to_string(count) + " blocks, the largest " +
+               std::to_string(largest);
+    };
+    if (stats.freeUnits != freeUnits || stats.freeBlocks != freeBlocks || stats.largestFree != largestFree ||
+        stats.usedUnits != allocator.capacity() - freeUnits || stats.usedBlocks != usedBlocks)
+        fail("counts " + describe(stats.freeUnits, stats.freeBlocks, stats.largestFree) + " and " +
+             std::to_string(stats.usedBlocks) + " used blocks, but holds " +
+             describe(freeUnits, freeBlocks, largestFree) + " and " + std::to_string(usedBlocks));
+    for (size_t process = 1; process < owned.size(); ++process) {
+        long long usage = allocator.usage(static_cast<ProcessHandle>(process));
+        if (usage != owned[process])
+            fail("charges " + allocator.processName(static_cast<ProcessHandle>(process)) + " " +
+                 std::to_string(usage) + " units for the " + std::to_string(owned[process]) + " it owns");
     }
+    return problem;
+}
+
+// Scripted sequences that once broke an invariant, too specific for random streams to find.
+// Each returns whether the requests it expects to succeed did.
+struct Regression {
+    const char* name;
+    int memorySize;
+    bool (*run)(MemoryAllocator&);
 };
 
-class MemoryAllocator {
-private:
-    int maxMemory;
-    std::vector<MemoryBlock> blocks;
+const Regression kRegressions[] = {
+    {"two allocations carved from a block released in a batch", 100,
+     [](MemoryAllocator& heap) {
+         using Request = MemoryAllocator::Request;
+         heap.processRequest(heap.internProcess("a"), 10, 'F');
+         heap.processRequest(heap.internProcess("b"), 40, 'F');
+         heap.processRequest(heap.internProcess("c"), 10, 'F');
+         heap.release(heap.internProcess("c"));
+         heap.processRequests({{Request::Release, heap.internProcess("b"), 0, 0},
+                               {Request::Allocate, heap.internProcess("d"), 5, 'F'},
+                               {Request::Allocate, heap.internProcess("e"), 5, 'F'}});
+         return heap.processRequest(heap.internProcess("f"), 70, 'F');
+     }},
+    {"an aligned allocation splitting a block released in a batch", 64,
+     [](MemoryAllocator& heap) {
+         using Request = MemoryAllocator::Request;
+         heap.processRequest(heap.internProcess("a"), 4, 'F');
+         heap.processRequest(heap.internProcess("b"), 8, 'F');
+         std::vector<bool> results = heap.processRequests({{Request::Release, heap.internProcess("b"), 0, 0},
+                                                           {Request::Allocate, heap.internProcess("c"), 2, 'F', 8}});
+         bool placed = results[1];
+         return placed;
+     }},
+    {"requests of zero and negative size", 100,
+     [](MemoryAllocator& heap) {
+         bool refused = !heap.processRequest("a", 0, 'F') && !heap.processRequest("b", -5, 'B');
+         return refused && heap.processRequest("c", 100, 'F');
+     }},
+    {"a resize after compaction, which must still pick the newest block", 100,
+     [](MemoryAllocator& heap) {
+         for (const char* name : {"a", "b", "c"}) heap.processRequest(name, 10, 'F');
+         heap.release("a");
+         heap.processRequest("a", 20, 'F');
+         heap.processRequest("a", 5, 'F');
+         heap.compact();
+         MemoryAllocator::Relocation relocation;
+         return heap.resize("a", 1, relocation) && relocation.oldStart == 0;
+     }},
+};
 
-    void sortBlocks() {
-        std::sort(blocks.begin(), blocks.end(), [](const MemoryBlock& a, const MemoryBlock& b) {
-            return a.start < b.start;
-        });
+// Runs every regression, reporting each one that fails
+bool runRegressions() {
+    bool ok = true;
+    for (const Regression& regression : kRegressions) {
+        MemoryAllocator heap(regression.memorySize);
+        bool succeeded = regression.run(heap);
+        std::string problem = invariantViolation(heap);
+        if (!succeeded || !problem.empty()) {
+            std::cerr << "Regression '" << regression.name << "': "
+                      << (problem.empty() ? "a request that should succeed failed" : problem) << "\n";
+            ok = false;
+        }
     }
+    return ok;
+}
 
-    void insertBlock(int start, int size, const std::string& process) {
-        blocks.emplace_back(start, start + size - 1, process);
-        sortBlocks();
-    }
+// What a stream exercises. The model follows the first two; the bitmap engine ignores the
+// strategy, so it only takes part in first-fit-only streams. Engine-only streams add what the
+// model has no equivalent for: next and segregated fit, alignment and granularity, batches,
+// deferred coalescing, resizing and incremental compaction. There the int and 64-bit engines
+// are checked against each other and against invariantViolation.
+enum class Stream { AllStrategies, FirstFitOnly, EngineOnly };
 
-    bool allocateByCriteria(const std::string& process, int size,
-                            std::function<bool(int, int)> comp) {
-        int index = -1;
-        int chosenSize = comp(0, 1) ? maxMemory + 1 : -1;
+struct Op {
+    enum Kind { Request, Release, Compact, Checkpoint, CompactStep, CompactMinimal, Resize, Batch, Defer } kind;
+    int process;  // one of kProcesses names
+    int size;     // also the step budget, hole size or coalesce threshold
+    char strategy;
+    int alignment = 1;
+};
 
-        for (size_t i = 0; i < blocks.size(); ++i) {
-            if (blocks[i].isFree() && blocks[i].size() >= size) {
-                if (index == -1 || comp(blocks[i].size(), chosenSize)) {
-                    index = static_cast<int>(i);
-                    chosenSize = blocks[i].size();
-                }
+constexpr int kProcesses = 32;
+
+// Three bytes per operation, so fuzzer mutations map onto operations evenly. The low three
+// bits of the first pick the kind (half of them requests), the rest the process; the others
+// give the strategy and a size, mostly under 64 units so equal-sized holes and ties are
+// common, sometimes up to a quarter of the heap. Engine-only streams take four bits for the
+// kind, leaving 16 processes, and align a quarter of requests to 2 to 16 units.
+Op decode(std::uint8_t a, std::uint8_t b, std::uint8_t c, int memorySize, Stream stream) {
+    static const Op::Kind kinds[8] = {Op::Request, Op::Request, Op::Request, Op::Request,
+                                      Op::Release, Op::Release, Op::Compact, Op::Checkpoint};
+    static const Op::Kind engineKinds[16] = {Op::Request, Op::Request, Op::Request, Op::Request, Op::Request,
+                                             Op::Request, Op::Release, Op::Release, Op::Release, Op::Compact,
+                                             Op::Checkpoint, Op::CompactStep, Op::CompactMinimal, Op::Resize,
+                                             Op::Batch, Op::Defer};
+    int span = b & 0xe0 ? 64 : std::max(1, memorySize / 4);
+    int size = 1 + ((b >> 2 & 0x7) << 8 | c) % span;
+    if (stream != Stream::EngineOnly)
+        return {kinds[a & 7], a >> 3, size, stream == Stream::FirstFitOnly ? 'F' : "FBW"[b % 3]};
+    return {engineKinds[a & 15], a >> 4, size, "FBWNS"[b % 5], b >> 6 == 3 ? 2 << c % 4 : 1};
+}
+
+class Differential {
+public:
+    static constexpr const char* kEngines[] = {"reference", "blocks", "blocks64", "bitmap"};
+
+    // `granularity` applies to the block engines of an engine-only stream
+    Differential(int memorySize, Stream stream, int granularity = 1)
+        : model(memorySize), blocks(std::make_unique<MemoryAllocator>(memorySize)),
+          wide(std::make_unique<MemoryAllocator64>(memorySize)), bitmap(memorySize, 1),
+          firstFitOnly(stream == Stream::FirstFitOnly), engineOnly(stream == Stream::EngineOnly),
+          granularity(engineOnly ? granularity : 1) {
+        for (int i = 0; i < kProcesses; ++i) names.push_back("p" + std::to_string(i));
+        blocks->setGranularity(this->granularity);
+        wide->setGranularity(this->granularity);
+    }
+
+    // Applies `op` everywhere; false, with the first disagreement on std::cerr, if any engine
+    // returns a different result or ends with a different block map than the model
+    bool apply(const Op& op, long long step) {
+        if (engineOnly) return applyToEngines(op, step);
+        const std::string& name = names[op.process];
+        bool results[4] = {};
+        switch (op.kind) {
+            case Op::Request:
+                results[0] = timed(0, [&] { return model.allocate(name, op.size, op.strategy); });
+                results[1] = timed(1, [&] { return blocks->processRequest(name, op.size, op.strategy); });
+                results[2] = timed(2, [&] { return wide->processRequest(name, op.size, op.strategy); });
+                results[3] = firstFitOnly && timed(3, [&] { return bitmap.processRequest(name, op.size, op.strategy); });
+                break;
+            case Op::Release:
+                results[0] = timed(0, [&] { return model.release(name); });
+                results[1] = timed(1, [&] { return blocks->release(name); });
+                results[2] = timed(2, [&] { return wide->release(name); });
+                results[3] = firstFitOnly && timed(3, [&] { return bitmap.release(name); });
+                break;
+            case Op::Compact:
+                results[0] = timed(0, [&] { model.compact(); return true; });
+                results[1] = timed(1, [&] { blocks->compact(); return true; });
+                results[2] = timed(2, [&] { wide->compact(); return true; });
+                results[3] = firstFitOnly && timed(3, [&] { bitmap.compact(); return true; });
+                break;
+            case Op::Checkpoint:
+                // The block engines continue from a restored copy of themselves; not timed, as
+                // the others have nothing to compare
+                results[0] = true;
+                results[1] = roundTrip(blocks);
+                results[2] = roundTrip(wide);
+                results[3] = firstFitOnly;
+                break;
+            default:
+                return report(op, step, 0, "cannot run this operation");
+        }
+        const BlockMap expected = model.blockList();
+        for (int engine = 1; engine < (firstFitOnly ? 4 : 3); ++engine) {
+            if (results[engine] != results[0])
+                return report(op, step, engine, results[engine] ? "succeeded" : "failed");
+            BlockMap actual = engine == 1 ? blockMapOf(*blocks) : engine == 2 ? blockMapOf(*wide) : blockMapOf(bitmap);
+            size_t i = 0;
+            while (i < expected.size() && i < actual.size() && expected[i] == actual[i]) ++i;
+            if (i < expected.size() || i < actual.size()) {
+                auto describe = [&](const BlockMap& map) {
+                    if (i >= map.size()) return std::string("nothing");
+                    return "[" + std::to_string(map[i].start) + ":" + std::to_string(map[i].end) + "] " +
+                           (map[i].isFree() ? std::string("free") : map[i].process);
+                };
+                return report(op, step, engine, "has " + describe(actual) + " as block " + std::to_string(i) +
+                                                    ", the model " + describe(expected));
             }
         }
+        for (int engine = 1; engine < 3; ++engine) {
+            std::string problem = engine == 1 ? invariantViolation(*blocks) : invariantViolation(*wide);
+            if (!problem.empty()) return report(op, step, engine, problem);
+        }
+        return true;
+    }
 
-        if (index == -1) return false;
+    // Timed operations in `engine` and the time they took
+    long long operationsIn(int engine) const {
+        return operations[engine];
+    }
 
-        int start = blocks[index].start;
-        int end = start + size - 1;
+    double secondsIn(int engine) const {
+        return seconds[engine];
+    }
+
+private:
+    ReferenceAllocator model;
+    std::unique_ptr<MemoryAllocator> blocks;
+    std::unique_ptr<MemoryAllocator64> wide;
+    BitmapAllocator bitmap;
+    bool firstFitOnly;
+    bool engineOnly;
+    int granularity;
+    std::vector<std::string> names;
+    double seconds[4] = {};
+    long long operations[4] = {};
+
+    template <typename Work>
+    std::invoke_result_t<Work> timed(int engine, Work work) {
+        auto begin = std::chrono::steady_clock::now();
+        auto result = work();
+        seconds[engine] += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        ++operations[engine];
+        return result;
+    }
+
+    // What `op` returns on one block engine, one entry per request for a batch
+    template <typename Allocator>
+    std::vector<bool> outcome(Allocator& heap, const Op& op) {
+        using Request = typename Allocator::Request;
+        ProcessHandle process = heap.internProcess(names[op.process]);
+        typename Allocator::Relocation relocation;
+        std::vector<typename Allocator::Relocation> relocations;
+        switch (op.kind) {
+            case Op::Request:
+                return {heap.processRequest(process, op.size, op.strategy, op.alignment)};
+            case Op::Release:
+                return {heap.release(process)};
+            case Op::Compact:
+                heap.compact();
+                return {true};
+            case Op::CompactStep:
+                return {heap.compactStep(op.size % 8).done};
+            case Op::CompactMinimal:
+                return {heap.compactMinimal(op.size, relocations)};
+            case Op::Resize:
+                return {heap.resize(process, op.size, relocation)};
+            case Op::Batch: {
+                // Carve the released block twice over, so pending merges and splits interleave
+                ProcessHandle second = heap.internProcess(names[(op.process + 1) % kProcesses]);
+                ProcessHandle third = heap.internProcess(names[(op.process + 2) % kProcesses]);
+                return heap.processRequests({{Request::Release, process, 0, 0},
+                                             {Request::Allocate, second, op.size, op.strategy, op.alignment},
+                                             {Request::Allocate, third, op.size / 2 + 1, op.strategy}});
+            }
+            case Op::Defer:
+                heap.setCoalesceThreshold(static_cast<size_t>(op.size % 4));
+                return {true};
+            case Op::Checkpoint:
+                break;
+        }
+        return {};
+    }
 
-        if (blocks[index].size() > size) {
-            blocks[index].start = end + 1;
+    // Engine-only streams: both block engines must agree on each result and block map and
+    // keep their invariants, and neither may refuse a request a free block could hold
+    bool applyToEngines(const Op& op, long long step) {
+        std::vector<bool> results[3];
+        if (op.kind == Op::Checkpoint) {
+            results[1] = {roundTrip(blocks)};
+            results[2] = {roundTrip(wide)};
         } else {
-            blocks.erase(blocks.begin() + index);
+            results[1] = timed(1, [&] { return outcome(*blocks, op); });
+            results[2] = timed(2, [&] { return outcome(*wide, op); });
+        }
+        if (results[1] != results[2]) return report(op, step, 2, "disagrees with blocks on the result");
+        if (!results[1].empty() && !results[1][0] && op.kind == Op::Checkpoint)
+            return report(op, step, 1, "failed to restore its checkpoint");
+        if (blockMapOf(*blocks) != blockMapOf(*wide)) return report(op, step, 2, "disagrees with blocks on the map");
+        for (int engine = 1; engine < 3; ++engine) {
+            std::string problem = engine == 1 ? invariantViolation(*blocks) : invariantViolation(*wide);
+            if (!problem.empty()) return report(op, step, engine, problem);
         }
+        if (op.kind == Op::Request && !results[1][0] && !blocks->coalescingPending()) {
+            // Rounded as processRequest does; any hole of size + alignment - 1 fits the block
+            long long alignment = std::max(op.alignment, granularity);
+            long long size = (op.size + granularity - 1) / granularity * granularity;
+            if (blocks->stats().largestFree >= size + alignment - 1)
+                return report(op, step, 1, "failed with a free block of " +
+                                               std::to_string(blocks->stats().largestFree) + " units");
+        }
+        return true;
+    }
 
-        insertBlock(start, size, process);
+    template <typename Allocator>
+    static bool roundTrip(std::unique_ptr<Allocator>& allocator) {
+        std::string checkpoint;
+        allocator->save(checkpoint);
+        std::unique_ptr<Allocator> restored = Allocator::restore(checkpoint.data(), checkpoint.size());
+        if (!restored) return false;
+        allocator = std::move(restored);
         return true;
     }
 
-public:
-    explicit MemoryAllocator(int size) : maxMemory(size) {
-        blocks.emplace_back(0, size - 1);
+    bool report(const Op& op, long long step, int engine, const std::string& problem) const {
+        static const char* kinds[] = {"RQ", "RL", "C", "SAVE/LOAD", "C", "C MIN", "RESIZE", "BATCH RL", "POLICY COALESCE"};
+        std::cerr << "Mismatch at step " << step << " (" << kinds[op.kind];
+        switch (op.kind) {
+            case Op::Request:
+                std::cerr << " " << names[op.process] << " " << op.size << " " << op.strategy;
+                if (op.alignment > 1) std::cerr << " " << op.alignment;
+                break;
+            case Op::Batch:
+                std::cerr << " " << names[op.process] << ", RQ " << op.size << " " << op.strategy << " "
+                          << op.alignment << ", RQ " << op.size / 2 + 1;
+                break;
+            case Op::Release:
+                std::cerr << " " << names[op.process];
+                break;
+            case Op::Resize:
+                std::cerr << " " << names[op.process] << " " << op.size;
+                break;
+            case Op::CompactStep:
+                std::cerr << " " << op.size % 8;
+                break;
+            case Op::CompactMinimal:
+                std::cerr << " " << op.size;
+                break;
+            case Op::Defer:
+                std::cerr << " " << op.size % 4;
+                break;
+            default:
+                break;
+        }
+        std::cerr << "): " << kEngines[engine] << " " << problem << "\n";
+        return false;
     }
+};
 
-    bool allocateFirstFit(const std::string& process, int size) {
-        for (size_t i = 0; i < blocks.size(); ++i) {
-            if (blocks[i].isFree() && blocks[i].size() >= size) {
-                int start = blocks[i].start;
-                int end = start + size - 1;
+// One fuzzer input: two bytes of heap size, a byte whose low bits pick the stream (the top
+// two of its four values engine-only) and next two the granularity, then operations as in
+// decode()
+bool runInput(const std::uint8_t* data, size_t size) {
+    if (size < 3) return true;
+    int memorySize = 1 + (data[0] << 8 | data[1]) % 4096;
+    Stream stream = static_cast<Stream>(std::min(data[2] & 3, 2));
+    Differential differential(memorySize, stream, 1 << (data[2] >> 2 & 3));
+    long long step = 0;
+    for (size_t i = 3; i + 3 <= size; i += 3)
+        if (!differential.apply(decode(data[i], data[i + 1], data[i + 2], memorySize, stream), step++))
+            return false;
+    return true;
+}
 
-                if (blocks[i].size() > size) {
-                    blocks[i].start = end + 1;
+// Threads share one sharded engine behind a small-block cache, each allocating and releasing
+// its own blocks. The blocks held at the end must lie in the heap and not overlap. `counters`
+// receives the cache's.
+bool runConcurrent(int threads, long long steps, double& seconds, long long& operations,
+                   std::vector<SmallBlockCache::Counters>& counters) {
+    static constexpr int kHeap = 1 << 22;
+    ConcurrentAllocator shared(kHeap, threads);
+    SmallBlockCache cache(shared, {16, 32, 64}, CachedAllocator::kSlotsPerSize);
+    std::vector<std::vector<std::pair<int, int>>> held(threads);
+    std::atomic<long long> done{0};
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(1000 + t);
+            std::vector<std::pair<int, int>>& live = held[t];
+            for (long long step = 0; step < steps; ++step) {
+                if (live.size() < 256 && (live.empty() || rng() % 2)) {
+                    // Mostly cached sizes, some past the largest class so the arenas see traffic
+                    int size = rng() % 8 ? 1 + static_cast<int>(rng() % 64) : 65 + static_cast<int>(rng() % 512);
+                    int address = cache.allocate(size);
+                    if (address >= 0) live.emplace_back(address, size);
                 } else {
-                    blocks.erase(blocks.begin() + i);
+                    size_t victim = rng() % live.size();
+                    cache.release(live[victim].first, live[victim].second);
+                    live[victim] = live.back();
+                    live.pop_back();
                 }
+            }
+            done += steps;
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    operations = done;
+    counters = cache.counters();
 
-                insertBlock(start, size, process);
-                return true;
+    std::vector<std::pair<int, int>> all;
+    for (const auto& live : held) all.insert(all.end(), live.begin(), live.end());
+    std::sort(all.begin(), all.end());
+    for (size_t i = 0; i < all.size(); ++i) {
+        bool inHeap = all[i].first >= 0 && all[i].first + all[i].second <= kHeap;
+        if (!inHeap || (i + 1 < all.size() && all[i].first + all[i].second > all[i + 1].first)) {
+            std::cerr << "Concurrent stress: block [" << all[i].first << ", +" << all[i].second << ") "
+                      << (inHeap ? "overlaps the next one held" : "lies outside the heap") << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// --stress: the regressions, then `threads` differential streams of `steps` operations each,
+// taking the stream kinds in turn, then the concurrent run. Returns the process exit code.
+int run(long long steps, int threads) {
+    bool regressionsOk = runRegressions();
+    std::cout << "Regressions: " << std::size(kRegressions) << " cases, " << (regressionsOk ? "all passed" : "FAILED")
+              << "\n";
+
+    std::vector<std::unique_ptr<Differential>> runs(threads);
+    std::vector<char> passed(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            int memorySize = 256 + static_cast<int>(rng() % 8192);
+            Stream stream = static_cast<Stream>(t % 3);
+            runs[t] = std::make_unique<Differential>(memorySize, stream, 1 << (t / 3 % 4));
+            passed[t] = true;
+            for (long long step = 0; step < steps && passed[t]; ++step) {
+                std::uint32_t bits = static_cast<std::uint32_t>(rng());
+                passed[t] = runs[t]->apply(decode(bits & 0xff, bits >> 8 & 0xff, bits >> 16 & 0xff, memorySize, stream),
+                                           step);
             }
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+
+    bool ok = std::all_of(passed.begin(), passed.end(), [](char p) { return p != 0; });
+    std::cout << "Differential: " << threads << " streams x " << steps << " steps, "
+              << (ok ? "no mismatches or broken invariants" : "MISMATCH") << "\n"
+              << std::left << std::setw(11) << "engine" << std::right << std::setw(14) << "ops/sec" << "\n";
+    for (int engine = 0; engine < 4; ++engine) {
+        long long operations = 0;
+        double seconds = 0;
+        for (int t = 0; t < threads; ++t) {
+            operations += runs[t]->operationsIn(engine);
+            seconds += runs[t]->secondsIn(engine);
         }
-        return false;
+        std::cout << std::left << std::setw(11) << Differential::kEngines[engine] << std::right << std::setw(14)
+                  << std::fixed << std::setprecision(0) << (seconds > 0 ? operations / seconds : 0.0) << "\n";
+    }
+
+    double seconds = 0;
+    long long operations = 0;
+    std::vector<SmallBlockCache::Counters> counters;
+    bool concurrentOk = runConcurrent(threads, steps, seconds, operations, counters);
+    std::cout << "Concurrent: " << threads << " threads x " << steps << " steps on sharded + cache, "
+              << (concurrentOk ? "no overlapping blocks" : "FAILED") << ", " << std::fixed << std::setprecision(0)
+              << (seconds > 0 ? operations / seconds : 0.0) << " ops/sec\n";
+    for (const SmallBlockCache::Counters& c : counters) {
+        std::cout << "  cache " << std::left << std::setw(4) << c.size << std::right << c.hits << " hits, " << c.misses
+                  << " misses, " << c.cachedReleases << " cached releases, " << c.overflowReleases
+                  << " overflow releases\n";
+    }
+    return regressionsOk && ok && concurrentOk ? 0 : 1;
+}
+
+}  // namespace stress
+
+#ifdef ALLOCATOR_FUZZ
+// libFuzzer target, built without the driver's main:
+//   clang++ -std=c++17 -O1 -g -fsanitize=fuzzer,address,undefined -DALLOCATOR_FUZZ main.cpp
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, size_t size) {
+    if (!stress::runInput(data, size)) std::abort();
+    return 0;
+}
+#endif
+
+// Binary traces of driver operations (--record) and a replayer that feeds them straight into
+// a MemoryAllocator (--replay). Layout, all little-endian: "MATR", u32 version, u32 memory
+// size, then records of u64 nanoseconds since recording started, u8 op, u8 strategy,
+// u32 process id and u32 argument. A Name record carries the process name in its argument's
+// length of bytes right after it, and must precede the first use of the id.
+namespace trace {
+
+enum class Op : std::uint8_t {
+    Name,                 // argument: name length
+    Request,              // argument: size
+    Release,
+    Compact,
+    CompactStep,          // argument: block budget
+    CompactMinimal,       // argument: required size
+    BatchBegin,
+    BatchEnd,
+    Align,                // argument: alignment of the next request
+    Granularity,          // argument: units every request is rounded to
+    Resize,               // argument: new size of the process's latest block
+    Quota,                // argument: units the process may own, kNoQuota for no cap
+    CompactionPolicy,     // argument: 1 compacts on demand, 0 never
+    BackgroundCompaction, // argument: blocks moved per request, 0 for off
+    CoalesceThreshold     // argument: released blocks left unmerged, 0 merges on release
+};
+
+constexpr std::uint32_t kNoQuota = std::numeric_limits<std::uint32_t>::max();
+
+constexpr char kMagic[4] = {'M', 'A', 'T', 'R'};
+constexpr std::uint32_t kVersion = 1;
+
+template <typename T>
+void put(std::string& out, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+template <typename T>
+bool take(const std::string& in, size_t& pos, T& value) {
+    if (in.size() - pos < sizeof(T)) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+class Writer {
+private:
+    std::ofstream file;
+    std::string buffer;
+    std::unordered_map<std::string, std::uint32_t> ids;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    void record(Op op, std::uint32_t process = 0, std::uint32_t argument = 0, char strategy = 0) {
+        put<std::uint64_t>(buffer, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       std::chrono::steady_clock::now() - started).count());
+        put<std::uint8_t>(buffer, static_cast<std::uint8_t>(op));
+        put<std::uint8_t>(buffer, static_cast<std::uint8_t>(strategy));
+        put<std::uint32_t>(buffer, process);
+        put<std::uint32_t>(buffer, argument);
+        if (buffer.size() >= (1 << 16)) flush();
+    }
+
+    std::uint32_t idOf(const std::string& name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+
+        std::uint32_t id = static_cast<std::uint32_t>(ids.size());
+        ids.emplace(name, id);
+        record(Op::Name, id, static_cast<std::uint32_t>(name.size()));
+        buffer += name;
+        return id;
     }
 
-    bool allocateBestFit(const std::string& process, int size) {
-        return allocateByCriteria(process, size, std::less<int>());
+public:
+    Writer(const std::string& path, int memorySize) : file(path, std::ios::binary | std::ios::trunc) {
+        buffer.append(kMagic, sizeof(kMagic));
+        put<std::uint32_t>(buffer, kVersion);
+        put<std::uint32_t>(buffer, static_cast<std::uint32_t>(memorySize));
     }
 
-    bool allocateWorstFit(const std::string& process, int size) {
-        return allocateByCriteria(process, size, std::greater<int>());
+    ~Writer() {
+        flush();
     }
 
-    bool release(const std::string& process) {
-        bool found = false;
-        for (auto& block : blocks) {
-            if (block.process == process) {
-                block.process = "";
-                found = true;
+    bool ok() const {
+        return file.good();
+    }
+
+    void flush() {
+        file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        file.flush();
+        buffer.clear();
+    }
+
+    void request(const std::string& process, int size, char strategy, int alignment = 1) {
+        std::uint32_t id = idOf(process);
+        if (alignment != 1) record(Op::Align, 0, static_cast<std::uint32_t>(alignment));
+        record(Op::Request, id, static_cast<std::uint32_t>(size), strategy);
+    }
+
+    void granularity(int units) {
+        record(Op::Granularity, 0, static_cast<std::uint32_t>(units));
+    }
+
+    // A policy change that alters later outcomes: CompactionPolicy, BackgroundCompaction or
+    // CoalesceThreshold
+    void setting(Op op, long long value) {
+        record(op, 0, static_cast<std::uint32_t>(value));
+    }
+
+    void release(const std::string& process) {
+        record(Op::Release, idOf(process));
+    }
+
+    void resize(const std::string& process, int size) {
+        record(Op::Resize, idOf(process), static_cast<std::uint32_t>(size));
+    }
+
+    void quota(const std::string& process, long long units) {
+        record(Op::Quota, idOf(process), units < 0 ? kNoQuota : static_cast<std::uint32_t>(units));
+    }
+
+    void compact(Op op = Op::Compact, int argument = 0) {
+        record(op, 0, static_cast<std::uint32_t>(argument));
+    }
+
+    void batchBegin() {
+        record(Op::BatchBegin);
+    }
+
+    void batchEnd() {
+        record(Op::BatchEnd);
+    }
+};
+
+struct ReplayResult {
+    long long operations = 0;
+    long long failures = 0;
+    double seconds = 0;
+    double fragmentation = 0;
+    bool ok = true;
+};
+
+// Replays the whole trace against a fresh allocator; `strategy` other than 0 overrides the
+// recorded strategy of every request. The file is parsed up front so only allocator work is
+// timed.
+ReplayResult replay(const std::string& contents, char strategy) {
+    ReplayResult result;
+    size_t pos = sizeof(kMagic);
+    std::uint32_t version = 0, memorySize = 0;
+    if (contents.compare(0, sizeof(kMagic), kMagic, sizeof(kMagic)) != 0 || !take(contents, pos, version) ||
+        version != kVersion || !take(contents, pos, memorySize)) {
+        result.ok = false;
+        return result;
+    }
+
+    struct Record {
+        Op op;
+        char strategy;
+        std::uint32_t process;
+        std::uint32_t argument;
+    };
+    MemoryAllocator allocator(static_cast<int>(memorySize));
+    std::vector<ProcessHandle> handles;
+    std::vector<Record> records;
+
+    while (pos < contents.size()) {
+        std::uint64_t timestamp;
+        std::uint8_t op, recorded;
+        Record record;
+        if (!take(contents, pos, timestamp) || !take(contents, pos, op) || !take(contents, pos, recorded) ||
+            !take(contents, pos, record.process) || !take(contents, pos, record.argument) ||
+            op > static_cast<std::uint8_t>(Op::CoalesceThreshold)) {
+            result.ok = false;
+            return result;
+        }
+        record.op = static_cast<Op>(op);
+        record.strategy = strategy ? strategy : static_cast<char>(recorded);
+
+        if (record.op == Op::Name) {
+            if (contents.size() - pos < record.argument || record.process != handles.size()) {
+                result.ok = false;
+                return result;
             }
+            handles.push_back(allocator.internProcess(contents.substr(pos, record.argument)));
+            pos += record.argument;
+        } else if (record.op != Op::Request && record.op != Op::Release && record.op != Op::Resize &&
+                   record.op != Op::Quota) {
+            records.push_back(record);
+        } else if (record.process < handles.size()) {
+            record.process = handles[record.process];
+            records.push_back(record);
+        } else {
+            result.ok = false;
+            return result;
         }
-        if (found) mergeAdjacentFreeBlocks();
-        return found;
     }
 
-    void mergeAdjacentFreeBlocks() {
-        sortBlocks();
-        for (size_t i = 0; i < blocks.size() - 1;) {
-            if (blocks[i].isFree() && blocks[i + 1].isFree()) {
-                blocks[i].end = blocks[i + 1].end;
-                blocks.erase(blocks.begin() + i + 1);
-            } else {
-                ++i;
+    std::vector<MemoryAllocator::Request> batch;
+    bool inBatch = false;
+    int alignment = 1;
+    std::vector<MemoryAllocator::Relocation> relocations;
+    auto begin = std::chrono::steady_clock::now();
+    for (const Record& record : records) {
+        bool succeeded = true;
+        switch (record.op) {
+            case Op::Request: {
+                int size = static_cast<int>(record.argument);
+                int requestAlignment = std::exchange(alignment, 1);
+                if (inBatch) {
+                    batch.push_back({MemoryAllocator::Request::Allocate, record.process, size, record.strategy,
+                                     requestAlignment});
+                    continue;
+                }
+                succeeded = allocator.processRequest(record.process, size, record.strategy, requestAlignment);
+                break;
+            }
+            case Op::Align:
+                alignment = static_cast<int>(record.argument);
+                continue;
+            case Op::Granularity:
+                allocator.setGranularity(static_cast<int>(record.argument));
+                continue;
+            case Op::Release:
+                if (inBatch) {
+                    batch.push_back({MemoryAllocator::Request::Release, record.process, 0, 0});
+                    continue;
+                }
+                allocator.release(record.process);
+                break;
+            case Op::Resize: {
+                MemoryAllocator::Relocation moved;
+                succeeded = allocator.resize(record.process, static_cast<int>(record.argument), moved);
+                break;
+            }
+            case Op::Quota:
+                allocator.setQuota(record.process,
+                                   record.argument == kNoQuota ? -1LL : static_cast<long long>(record.argument));
+                continue;
+            case Op::CompactionPolicy:
+                allocator.setCompactionPolicy(record.argument ? MemoryAllocator::CompactionPolicy::OnDemand
+                                                              : MemoryAllocator::CompactionPolicy::Never);
+                continue;
+            case Op::BackgroundCompaction:
+                allocator.setBackgroundCompaction(static_cast<int>(record.argument));
+                continue;
+            case Op::CoalesceThreshold:
+                allocator.setCoalesceThreshold(record.argument);
+                continue;
+            case Op::Compact:
+                allocator.compact();
+                break;
+            case Op::CompactStep:
+                allocator.compactStep(static_cast<int>(record.argument));
+                break;
+            case Op::CompactMinimal:
+                relocations.clear();
+                allocator.compactMinimal(static_cast<int>(record.argument), relocations);
+                break;
+            case Op::BatchBegin:
+                inBatch = true;
+                batch.clear();
+                continue;
+            case Op::BatchEnd: {
+                inBatch = false;
+                std::vector<bool> results = allocator.processRequests(batch);
+                for (size_t i = 0; i < batch.size(); ++i)
+                    if (batch[i].kind == MemoryAllocator::Request::Allocate && !results[i]) ++result.failures;
+                result.operations += static_cast<long long>(batch.size());
+                continue;
             }
+            default:
+                break;
         }
+        ++result.operations;
+        result.failures += !succeeded;
     }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
 
-    void compact() {
-        sortBlocks();
-        std::vector<MemoryBlock> newBlocks;
-        int nextFreeAddress = 0;
+    result.fragmentation = allocator.stats().externalFragmentation;
+    return result;
+}
 
-        for (const auto& block : blocks) {
-            if (!block.isFree()) {
-                int sz = block.size();
-                newBlocks.emplace_back(nextFreeAddress, nextFreeAddress + sz - 1, block.process);
-                nextFreeAddress += sz;
+// Replays `path` once per strategy in `strategies` ("" replays the recorded strategies)
+int replayFile(const std::string& path, const std::string& strategies) {
+    std::ifstream file(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file && !file.eof()) {
+        std::cerr << "Error: Cannot read trace '" << path << "'\n";
+        return 1;
+    }
+
+    std::string runs = strategies.empty() ? std::string(1, '\0') : strategies;
+    for (char strategy : runs) {
+        ReplayResult result = replay(contents, static_cast<char>(std::toupper(strategy)));
+        if (!result.ok) {
+            std::cerr << "Error: '" << path << "' is not a valid trace\n";
+            return 1;
+        }
+        std::cout << "Strategy " << (strategy ? std::string(1, static_cast<char>(std::toupper(strategy))) : "as recorded")
+                  << ": " << result.operations << " ops in " << std::fixed << std::setprecision(3)
+                  << result.seconds * 1000 << " ms (" << std::setprecision(0)
+                  << (result.seconds > 0 ? result.operations / result.seconds : 0) << " ops/sec) | Failed requests: "
+                  << result.failures << " | Fragmentation: " << std::setprecision(1) << 100 * result.fragmentation
+                  << "%\n";
+    }
+    return 0;
+}
+
+}  // namespace trace
+
+// ================================ Heap map dumps ================================
+// Columnar block map for dashboards and offline tools (STAT DUMP), built in one pass over the
+// block map with no per-block formatting. Layout, all little-endian: "MAHM", u32 version,
+// u32 flags, u32 memory size, u32 first and last address of the range, u32 block count and
+// u32 name count; then each name as u32 length and bytes (its index is the handle, 0 being
+// free); then the columns: count x u32 starts, count x u32 sizes, count x u32 handles. With
+// kDeltaStarts each start is stored as the distance from the previous block's start (the
+// first one absolute), which keeps the column small once compressed.
+namespace heapmap {
+
+constexpr char kMagic[4] = {'M', 'A', 'H', 'M'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::uint32_t kDeltaStarts = 1;
+
+// Dumps the blocks overlapping [from, to] to `path`
+bool write(const MemoryAllocator& allocator, const std::string& path, int memorySize, int from, int to,
+           std::uint32_t flags) {
+    std::vector<std::uint32_t> starts, sizes, handles;
+    int previous = 0;
+    allocator.forEachBlockIn(from, to, [&](const MemoryBlock& block) {
+        starts.push_back(static_cast<std::uint32_t>(flags & kDeltaStarts ? block.start - previous : block.start));
+        sizes.push_back(static_cast<std::uint32_t>(block.size()));
+        handles.push_back(block.process);
+        previous = block.start;
+    });
+
+    const std::vector<std::string>& names = allocator.processNames();
+    std::string out;
+    out.reserve(32 + 12 * starts.size());
+    out.append(kMagic, sizeof(kMagic));
+    for (std::uint32_t field : {kVersion, flags, static_cast<std::uint32_t>(memorySize), static_cast<std::uint32_t>(from),
+                                static_cast<std::uint32_t>(to), static_cast<std::uint32_t>(starts.size()),
+                                static_cast<std::uint32_t>(names.size())})
+        trace::put<std::uint32_t>(out, field);
+    for (const std::string& name : names) {
+        trace::put<std::uint32_t>(out, static_cast<std::uint32_t>(name.size()));
+        out += name;
+    }
+    for (const std::vector<std::uint32_t>* column : {&starts, &sizes, &handles})
+        out.append(reinterpret_cast<const char*>(column->data()), column->size() * sizeof(std::uint32_t));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(out.data(), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(file);
+}
+
+}  // namespace heapmap
+
+// Read-only view of a whole file: mapped where the platform has mmap, read into memory otherwise
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::string contents;
+#if defined(__unix__) || defined(__APPLE__)
+    void* mapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapping) munmap(mapping, length);
+#endif
+    }
+
+    bool open(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                madvise(view, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                mapping = view;
+                bytes = static_cast<const char*>(view);
+                length = static_cast<size_t>(info.st_size);
             }
         }
+        ::close(fd);
+        if (mapping) return true;
+#endif
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = contents.data();
+        length = contents.size();
+        return true;
+    }
 
-        if (nextFreeAddress < maxMemory)
-            newBlocks.emplace_back(nextFreeAddress, maxMemory - 1, "");
+    const char* data() const {
+        return bytes;
+    }
 
-        blocks = std::move(newBlocks);
+    size_t size() const {
+        return length;
     }
+};
 
-    void printStatus() const {
-        std::cout << "\nMemory Status:\n";
-        for (const auto& block : blocks) {
-            std::string status = block.isFree() ? "Unused" : "Process " + block.process;
-            std::cout << "Addresses [" << block.start << ":" << block.end << "] "
-                      << status << " | Size: " << block.size() << "\n";
+// ================================ Script input ================================
+// Non-interactive command ingestion: a script is mapped (or read) into memory at once and
+// walked line by line, and tokens are views into it, so parsing a command allocates nothing.
+namespace script {
+
+// Splits a command line on whitespace without copying it
+class Tokenizer {
+private:
+    std::string_view rest;
+
+public:
+    explicit Tokenizer(std::string_view line) : rest(line) {}
+
+    // Next whitespace-separated token, or an empty view at the end of the line
+    std::string_view next() {
+        size_t first = 0;
+        while (first < rest.size() && std::isspace(static_cast<unsigned char>(rest[first]))) ++first;
+        size_t last = first;
+        while (last < rest.size() && !std::isspace(static_cast<unsigned char>(rest[last]))) ++last;
+        std::string_view token = rest.substr(first, last - first);
+        rest.remove_prefix(last);
+        return token;
+    }
+
+    bool next(std::string& value) {
+        std::string_view token = next();
+        value.assign(token.data(), token.size());
+        return !token.empty();
+    }
+
+    // Parses the leading digits of the next token; leaves `value` alone if there are none
+    bool next(int& value) { return toInt(next(), value); }
+    bool next(long long& value) { return toInt(next(), value); }
+
+    // First character of the next token
+    bool next(char& value) {
+        std::string_view token = next();
+        if (token.empty()) return false;
+        value = token.front();
+        return true;
+    }
+
+    template <typename Integer>
+    static bool toInt(std::string_view token, Integer& value) {
+        if (!token.empty() && token.front() == '+') token.remove_prefix(1);
+        return std::from_chars(token.data(), token.data() + token.size(), value).ec == std::errc();
+    }
+};
+
+// Command lines from the console, or from a whole script file ("-" is all of stdin)
+class Input {
+private:
+    const char* cursor = nullptr;
+    const char* end = nullptr;
+    std::string contents;  // console line, or all of stdin
+    MappedFile file;
+    bool console = true;
+
+public:
+    bool open(const std::string& path) {
+        console = false;
+        if (path == "-") {
+            contents.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+            cursor = contents.data();
+            end = cursor + contents.size();
+            return true;
         }
-        std::cout << std::endl;
+        if (!file.open(path)) return false;
+        cursor = file.data();
+        end = cursor + file.size();
+        return true;
     }
 
-    bool processRequest(const std::string& process, int size, char strategy) {
-        strategy = std::toupper(strategy);
-        switch (strategy) {
-            case 'F': return allocateFirstFit(process, size);
-            case 'B': return allocateBestFit(process, size);
-            case 'W': return allocateWorstFit(process, size);
-            default:
-                std::cerr << "Error: Unknown strategy '" << strategy << "'\n";
-                return false;
+    bool interactive() const { return console; }
+
+    // The next line without its line ending; the view stays valid until the next call
+    bool nextLine(std::string_view& line) {
+        if (console) {
+            if (!std::getline(std::cin, contents)) return false;
+            line = contents;
+        } else {
+            if (cursor == end) return false;
+            const char* newline = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+            const char* stop = newline ? newline : end;
+            line = std::string_view(cursor, stop - cursor);
+            cursor = newline ? newline + 1 : end;
         }
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        return true;
     }
 };
 
+}  // namespace script
+
 // Main driver function
-int main() {
+#ifndef ALLOCATOR_FUZZ
+int main(int argc, char* argv[]) {
+    std::string engine = "blocks";
+    int arenaCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int poolCount = 0;  // pools engine: one per NUMA node unless given
+    int snapshotChunkSpan = 0;
+    int granularity = 1;
+    bool runBenchmarks = false;
+    bool runStress = false;
+    long long stressSteps = 100000;
+    int stressThreads = static_cast<int>(std::max(2u, std::thread::hardware_concurrency()));
+    std::vector<int> benchBlocks = {1000, 10000, 100000};
+    std::vector<int> cacheSizes;  // sharded engine: sizes the small-block cache serves
+    int benchSteps = 20000;
+    std::string recordPath, replayPath, replayStrategies, scriptPath;
+    bool quiet = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--engine" && i + 1 < argc) engine = argv[++i];
+        else if (arg == "--arenas" && i + 1 < argc) arenaCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--pools" && i + 1 < argc) poolCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--granularity" && i + 1 < argc) granularity = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--snapshots" && i + 1 < argc) snapshotChunkSpan = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--bench") runBenchmarks = true;
+        else if (arg == "--stress") runStress = true;
+        else if (arg == "--stress-steps" && i + 1 < argc) stressSteps = std::max(1LL, std::atoll(argv[++i]));
+        else if (arg == "--stress-threads" && i + 1 < argc) stressThreads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--record" && i + 1 < argc) recordPath = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc) replayPath = argv[++i];
+        else if (arg == "--strategies" && i + 1 < argc) replayStrategies = argv[++i];
+        else if (arg == "--script" && i + 1 < argc) scriptPath = argv[++i];
+        else if (arg == "--quiet") quiet = true;
+        else if (arg == "--bench-steps" && i + 1 < argc) benchSteps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--bench-blocks" && i + 1 < argc) {
+            // Comma-separated live block counts, e.g. 1000,100000,10000000
+            benchBlocks.clear();
+            std::istringstream list(argv[++i]);
+            std::string count;
+            while (std::getline(list, count, ',')) benchBlocks.push_back(std::max(1, std::atoi(count.c_str())));
+        } else if (arg == "--cache-sizes" && i + 1 < argc) {
+            // Comma-separated block sizes, e.g. 16,32,64
+            std::istringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ',')) cacheSizes.push_back(std::max(1, std::atoi(size.c_str())));
+        }
+    }
+
+    if (!cacheSizes.empty() && engine != "sharded") {
+        std::cerr << "Error: --cache-sizes needs --engine sharded\n";
+        return 1;
+    }
+
+    if (runBenchmarks) {
+        bench::runAll(benchBlocks, benchSteps);
+        return 0;
+    }
+    if (runStress) return stress::run(stressSteps, stressThreads);
+    if (!replayPath.empty()) return trace::replayFile(replayPath, replayStrategies);
+
+    // A script runs without prompts, with C stdio unsynchronised so replies stay buffered
+    script::Input input;
+    if (!scriptPath.empty()) {
+        std::ios::sync_with_stdio(false);
+        if (!input.open(scriptPath)) {
+            std::cerr << "Error: Cannot read script '" << scriptPath << "'\n";
+            return 1;
+        }
+    }
+
+    long long heapSize = 0;
+    std::string_view line;
+    if (input.interactive()) std::cout << "Enter total memory size: ";
+    if (!input.nextLine(line) || !script::Tokenizer(line).next(heapSize) || heapSize <= 0) {
+        std::cerr << "Error: Expected the total memory size\n";
+        return 1;
+    }
+    // Only blocks64 addresses heaps past the int range; every other engine and format is 32-bit
+    if (heapSize > std::numeric_limits<int>::max() && (engine != "blocks64" || !recordPath.empty())) {
+        std::cerr << "Error: Memory sizes above " << std::numeric_limits<int>::max()
+                  << " need --engine blocks64 and cannot be recorded\n";
+        return 1;
+    }
+    int memorySize = static_cast<int>(std::min<long long>(heapSize, std::numeric_limits<int>::max()));
 
-     int memorySize;
-    std::cout << "Enter total memory size: ";
-    std::cin >> memorySize;
-    std::cin.ignore();
+    std::unique_ptr<AllocatorEngine> allocator;
+    if (engine == "buddy") {
+        allocator = std::make_unique<BuddyAllocator>(memorySize);
+    } else if (engine == "bitmap") {
+        allocator = std::make_unique<BitmapAllocator>(memorySize, granularity);
+    } else if (engine == "sharded" && !cacheSizes.empty()) {
+        auto cached = std::make_unique<CachedAllocator>(memorySize, arenaCount, cacheSizes);
+        if (snapshotChunkSpan > 0) cached->arenas().enableSnapshots(snapshotChunkSpan);
+        allocator = std::move(cached);
+    } else if (engine == "sharded") {
+        auto sharded = std::make_unique<ConcurrentAllocator>(memorySize, arenaCount);
+        if (snapshotChunkSpan > 0) sharded->enableSnapshots(snapshotChunkSpan);
+        allocator = std::move(sharded);
+    } else if (engine == "pools") {
+        // A pool per node of this machine, with its distances; two when it reports no nodes
+        std::vector<std::vector<int>> distances = PooledAllocator::systemDistances();
+        if (poolCount == 0) poolCount = distances.empty() ? 2 : static_cast<int>(distances.size());
+        allocator = std::make_unique<PooledAllocator>(memorySize, poolCount, distances);
+    } else if (engine == "blocks") {
+        allocator = std::make_unique<MemoryAllocator>(memorySize);
+    } else if (engine == "blocks64") {
+        allocator = std::make_unique<MemoryAllocator64>(heapSize);
+    } else {
+        std::cerr << "Error: Unknown engine '" << engine
+                  << "'. Available: blocks, blocks64, bitmap, buddy, sharded, pools\n";
+        return 1;
+    }
+    // Engine-specific commands need the block allocator itself
+    MemoryAllocator* blockAllocator = dynamic_cast<MemoryAllocator*>(allocator.get());
+    MemoryAllocator64* wideAllocator = dynamic_cast<MemoryAllocator64*>(allocator.get());
+    PooledAllocator* pooledAllocator = dynamic_cast<PooledAllocator*>(allocator.get());
+    CachedAllocator* cachedAllocator = dynamic_cast<CachedAllocator*>(allocator.get());
+    if ((blockAllocator && !blockAllocator->setGranularity(granularity)) ||
+        (wideAllocator && !wideAllocator->setGranularity(granularity))) {
+        std::cerr << "Error: The " << engine << " engine needs a power-of-two granularity\n";
+        return 1;
+    }
 
-    MemoryAllocator allocator(memorySize);
-    std::string line;
+    std::unique_ptr<trace::Writer> recorder;
+    if (!recordPath.empty()) {
+        recorder = std::make_unique<trace::Writer>(recordPath, memorySize);
+        if (!recorder->ok()) {
+            std::cerr << "Error: Cannot write trace '" << recordPath << "'\n";
+            return 1;
+        }
+        if (blockAllocator && granularity > 1) recorder->granularity(granularity);
+    }
+    // --quiet drops the per-command acknowledgements; reports and errors still print
+    std::ostream silent(nullptr);
+    std::ostream& reply = quiet ? silent : std::cout;
+    std::string process;
 
     while (true) {
-        std::cout << "allocator> ";
-        std::getline(std::cin, line);
-        std::istringstream iss(line);
-        std::string cmd;
-        iss >> cmd;
+        if (input.interactive()) std::cout << "allocator> ";
+        if (!input.nextLine(line)) break;
+        script::Tokenizer tokens(line);
+        std::string_view cmd = tokens.next();
 
         if (cmd == "X") break;
         else if (cmd == "RQ") {
-            std::string process;
-            int size;
-            char strategy;
-            iss >> process >> size >> strategy;
-            if (allocator.processRequest(process, size, strategy)) {
-                std::cout << "Allocated " << size << " bytes to " << process << "\n";
+            // RQ <process> <size> <strategy> [alignment]
+            long long size = 0, alignment = 1;
+            char strategy = 0;
+            tokens.next(process) && tokens.next(size) && tokens.next(strategy) && tokens.next(alignment);
+            if (size <= 0) {
+                std::cout << "Usage: RQ <process> <size> <strategy> [alignment], with a size above 0\n";
+                continue;
+            }
+            if (alignment != 1 && !blockAllocator && !wideAllocator) {
+                std::cout << "Aligned requests are not supported by the " << engine << " engine.\n";
+                continue;
+            }
+            int narrowSize = static_cast<int>(std::min<long long>(size, std::numeric_limits<int>::max()));
+            int narrowAlignment = static_cast<int>(std::min<long long>(alignment, std::numeric_limits<int>::max()));
+            if (recorder) recorder->request(process, narrowSize, strategy, narrowAlignment);
+            bool allocated;
+            if (wideAllocator)
+                allocated = wideAllocator->processRequest(wideAllocator->internProcess(process), size, strategy, alignment);
+            else if (size != narrowSize || alignment != narrowAlignment)
+                allocated = false;
+            else if (blockAllocator)
+                allocated = blockAllocator->processRequest(blockAllocator->internProcess(process), narrowSize, strategy,
+                                                           narrowAlignment);
+            else
+                allocated = allocator->processRequest(process, narrowSize, strategy);
+            if (allocated) {
+                if (blockAllocator && blockAllocator->lastCompactionReport().compacted) {
+                    const auto& report = blockAllocator->lastCompactionReport();
+                    reply << "Compacted on demand: moved " << report.blocksMoved << " blocks ("
+                          << report.unitsMoved << " units)\n";
+                }
+                reply << "Allocated " << size << " bytes to " << process << "\n";
             } else {
-                std::cout << "Failed to allocate " << size << " bytes to " << process << "\n";
+                reply << "Failed to allocate " << size << " bytes to " << process << "\n";
             }
         } else if (cmd == "RL") {
-            std::string process;
-            iss >> process;
-            if (allocator.release(process)) {
-                std::cout << "Released memory for " << process << "\n";
+            tokens.next(process);
+            if (recorder) recorder->release(process);
+            if (allocator->release(process)) {
+                reply << "Released memory for " << process << "\n";
+            } else {
+                reply << "Process '" << process << "' not found.\n";
+            }
+        } else if (cmd == "RESIZE") {
+            // RESIZE <process> <size> resizes the process's most recent block
+            int size = 0;
+            tokens.next(process) && tokens.next(size);
+            MemoryAllocator::Relocation moved;
+            if (!blockAllocator) {
+                std::cout << "RESIZE is not supported by the " << engine << " engine.\n";
+                continue;
+            }
+            if (recorder) recorder->resize(process, size);
+            if (!blockAllocator->resize(process, size, moved)) {
+                reply << "Failed to resize " << process << " to " << size << " units.\n";
+            } else if (moved.newStart == moved.oldStart) {
+                reply << "Resized " << process << " to " << moved.size << " units in place.\n";
+            } else {
+                reply << "Resized " << process << " to " << moved.size << " units; moved from " << moved.oldStart
+                      << " to " << moved.newStart << ".\n";
+            }
+        } else if (cmd == "QUOTA") {
+            // QUOTA <process> <units>|OFF caps what the process may own at once
+            std::string_view value;
+            long long units = -1;
+            tokens.next(process);
+            value = tokens.next();
+            if (!blockAllocator) {
+                std::cout << "QUOTA is not supported by the " << engine << " engine.\n";
+            } else if (process.empty() || (value != "OFF" && !(script::Tokenizer::toInt(value, units) && units >= 0))) {
+                std::cout << "Usage: QUOTA <process> <units>|OFF\n";
+            } else {
+                if (value == "OFF") units = -1;
+                if (recorder) recorder->quota(process, units);
+                blockAllocator->setQuota(blockAllocator->internProcess(process), units);
+                if (units < 0) reply << "Quota for " << process << " removed.\n";
+                else reply << "Quota for " << process << ": " << units << " units.\n";
+            }
+        } else if (cmd == "NODE" || cmd == "DISTANCE") {
+            // NODE <n> sets the node later requests come from; DISTANCE <from> <to> <d> edits the
+            // distance matrix that orders the fallback pools
+            int node = -1, to = -1, value = 0;
+            bool parsed = tokens.next(node) && (cmd == "NODE" || (tokens.next(to) && tokens.next(value)));
+            if (!pooledAllocator) {
+                std::cout << cmd << " is not supported by the " << engine << " engine.\n";
+            } else if (cmd == "NODE" && parsed && node >= 0 && pooledAllocator->setLocalNode(node)) {
+                reply << "Requests now come from node " << node << ".\n";
+            } else if (cmd == "DISTANCE" && parsed && node >= 0 && to >= 0 &&
+                       pooledAllocator->setDistance(node, to, value)) {
+                reply << "Distance from node " << node << " to " << to << ": " << value << ".\n";
+            } else if (cmd == "NODE") {
+                std::cout << "Usage: NODE <0-" << pooledAllocator->poolCount() - 1 << ">\n";
             } else {
-                std::cout << "Process '" << process << "' not found.\n";
+                std::cout << "Usage: DISTANCE <from> <to> <distance>, nodes 0-" << pooledAllocator->poolCount() - 1
+                          << ", distance above 0\n";
             }
         } else if (cmd == "C") {
-            allocator.compact();
-            std::cout << "Memory compacted.\n";
+            std::string_view arg = tokens.next();
+            if (arg.empty()) {
+                if (recorder) recorder->compact();
+                allocator->compact();
+                reply << "Memory compacted.\n";
+            } else if (!blockAllocator) {
+                std::cout << "Incremental compaction is not supported by the " << engine << " engine.\n";
+            } else if (arg == "MIN") {
+                int requiredSize = 0;
+                tokens.next(requiredSize);
+                if (recorder) recorder->compact(trace::Op::CompactMinimal, requiredSize);
+                std::vector<MemoryAllocator::Relocation> relocations;
+                if (!blockAllocator->compactMinimal(requiredSize, relocations)) {
+                    std::cout << "Not enough free memory for a hole of " << requiredSize << " units.\n";
+                } else {
+                    long long unitsMoved = 0;
+                    for (const auto& r : relocations) {
+                        reply << "Relocated " << blockAllocator->processName(r.process) << " from " << r.oldStart
+                              << " to " << r.newStart << " | Size: " << r.size << "\n";
+                        unitsMoved += r.size;
+                    }
+                    reply << "Moved " << relocations.size() << " blocks (" << unitsMoved << " units).\n";
+                }
+            } else if (arg == "AUTO") {
+                int budget = 0;
+                tokens.next(budget);
+                if (recorder) recorder->setting(trace::Op::BackgroundCompaction, std::max(0, budget));
+                blockAllocator->setBackgroundCompaction(budget);
+                if (budget > 0) reply << "Background compaction: " << budget << " blocks per request.\n";
+                else reply << "Background compaction off.\n";
+            } else {
+                int steps = 0;
+                script::Tokenizer::toInt(arg, steps);
+                if (recorder) recorder->compact(trace::Op::CompactStep, steps);
+                MemoryAllocator::CompactionProgress progress = blockAllocator->compactStep(steps);
+                reply << "Moved " << progress.blocksMoved << " blocks (" << progress.unitsMoved << " units)"
+                      << (progress.done ? "; memory compacted.\n" : "; compaction in progress.\n");
+            }
+        } else if (cmd == "BATCH") {
+            // RQ/RL lines up to END run as one batch and answer together
+            std::vector<MemoryAllocator::Request> requests;
+            std::vector<std::string> names;
+            while (input.nextLine(line) && line != "END") {
+                script::Tokenizer item(line);
+                std::string_view op = item.next();
+                int size = 0, alignment = 1;
+                char strategy = 'F';
+                item.next(process);
+                if (op == "RQ") {
+                    item.next(size) && item.next(strategy) && item.next(alignment);
+                    if (size <= 0) {
+                        std::cout << "Skipped '" << line << "': a request needs a size above 0.\n";
+                        continue;
+                    }
+                } else if (op != "RL") {
+                    std::cout << "Skipped '" << line << "': only RQ and RL are allowed in a batch.\n";
+                    continue;
+                }
+                if (!blockAllocator) continue;
+                requests.push_back({op == "RQ" ? MemoryAllocator::Request::Allocate : MemoryAllocator::Request::Release,
+                                    blockAllocator->internProcess(process), size, strategy, alignment});
+                names.push_back(process);
+            }
+            if (!blockAllocator) {
+                std::cout << "BATCH is not supported by the " << engine << " engine.\n";
+                continue;
+            }
+
+            if (recorder) {
+                recorder->batchBegin();
+                for (size_t i = 0; i < requests.size(); ++i) {
+                    if (requests[i].kind == MemoryAllocator::Request::Allocate)
+                        recorder->request(names[i], requests[i].size, requests[i].strategy, requests[i].alignment);
+                    else
+                        recorder->release(names[i]);
+                }
+                recorder->batchEnd();
+            }
+
+            std::vector<bool> results = blockAllocator->processRequests(requests);
+            int succeeded = 0;
+            for (size_t i = 0; i < requests.size(); ++i) {
+                reply << (i + 1) << ": ";
+                if (requests[i].kind == MemoryAllocator::Request::Allocate) {
+                    reply << (results[i] ? "Allocated " : "Failed to allocate ") << requests[i].size
+                          << " bytes to " << names[i] << "\n";
+                } else {
+                    reply << (results[i] ? "Released memory for " : "Not found: ") << names[i] << "\n";
+                }
+                succeeded += results[i];
+            }
+            std::cout << "Batch done: " << succeeded << "/" << requests.size() << " succeeded.\n";
+        } else if (cmd == "POLICY") {
+            std::string_view setting = tokens.next();
+            std::string_view value = tokens.next();
+            int pending = 0;
+            if (!blockAllocator) {
+                std::cout << "POLICY is not supported by the " << engine << " engine.\n";
+            } else if (setting == "COMPACT" && (value == "ON" || value == "OFF")) {
+                if (recorder) recorder->setting(trace::Op::CompactionPolicy, value == "ON");
+                blockAllocator->setCompactionPolicy(value == "ON" ? MemoryAllocator::CompactionPolicy::OnDemand
+                                                                  : MemoryAllocator::CompactionPolicy::Never);
+                reply << "Compaction on demand " << (value == "ON" ? "enabled" : "disabled") << ".\n";
+            } else if (setting == "COALESCE" && value == "OFF") {
+                if (recorder) recorder->setting(trace::Op::CoalesceThreshold, 0);
+                blockAllocator->setCoalesceThreshold(0);
+                reply << "Coalescing on every release.\n";
+            } else if (setting == "COALESCE" && script::Tokenizer::toInt(value, pending) && pending > 0) {
+                if (recorder) recorder->setting(trace::Op::CoalesceThreshold, pending);
+                blockAllocator->setCoalesceThreshold(static_cast<size_t>(pending));
+                reply << "Coalescing deferred until " << pending << " released blocks wait.\n";
+            } else {
+                std::cout << "Usage: POLICY COMPACT ON|OFF | POLICY COALESCE <pending>|OFF\n";
+            }
+        } else if (cmd == "SAVE" || cmd == "LOAD") {
+            // SAVE <file> checkpoints the block allocator; LOAD <file> replaces it with one
+            std::string path;
+            tokens.next(path);
+            if (!blockAllocator) {
+                std::cout << cmd << " is not supported by the " << engine << " engine.\n";
+            } else if (path.empty()) {
+                std::cout << "Usage: " << cmd << " <file>\n";
+            } else if (cmd == "SAVE") {
+                std::string checkpoint;
+                blockAllocator->save(checkpoint);
+                std::ofstream file(path, std::ios::binary | std::ios::trunc);
+                file.write(checkpoint.data(), static_cast<std::streamsize>(checkpoint.size()));
+                if (file) reply << "Checkpoint written to " << path << "\n";
+                else std::cout << "Error: Cannot write checkpoint '" << path << "'\n";
+            } else if (recorder) {
+                std::cout << "LOAD is not supported while recording a trace.\n";
+            } else {
+                MappedFile file;
+                std::unique_ptr<MemoryAllocator> restored;
+                if (!file.open(path)) {
+                    std::cout << "Error: Cannot read checkpoint '" << path << "'\n";
+                } else if (!(restored = MemoryAllocator::restore(file.data(), file.size()))) {
+                    std::cout << "Error: '" << path << "' is not a valid checkpoint\n";
+                } else {
+                    memorySize = restored->capacity();
+                    blockAllocator = restored.get();
+                    allocator = std::move(restored);
+                    reply << "Checkpoint loaded from " << path << " | Memory: " << memorySize << "\n";
+                }
+            }
         } else if (cmd == "STAT") {
-            allocator.printStatus();
+            // STAT [SUMMARY | <from> <to> | DUMP <file> [DELTA] [<from> <to>]]
+            std::string_view view = tokens.next();
+            int from = 0, to = memorySize - 1;
+            if (view.empty()) {
+                allocator->printStatus();
+            } else if (pooledAllocator && view == "SUMMARY") {
+                pooledAllocator->printSummary();
+            } else if (!blockAllocator) {
+                std::cout << "STAT " << view << " is not supported by the " << engine << " engine.\n";
+            } else if (view == "SUMMARY") {
+                blockAllocator->printSummary();
+            } else if (view == "DUMP") {
+                std::string path;
+                std::uint32_t flags = 0;
+                tokens.next(path);
+                std::string_view next = tokens.next();
+                if (next == "DELTA") {
+                    flags |= heapmap::kDeltaStarts;
+                    next = tokens.next();
+                }
+                if (!next.empty() && !(script::Tokenizer::toInt(next, from) && tokens.next(to))) {
+                    std::cout << "Usage: STAT DUMP <file> [DELTA] [<from> <to>]\n";
+                } else if (path.empty() || !heapmap::write(*blockAllocator, path, memorySize, from, to, flags)) {
+                    std::cout << "Error: Cannot write heap map '" << path << "'\n";
+                } else {
+                    reply << "Heap map written to " << path << "\n";
+                }
+            } else if (script::Tokenizer::toInt(view, from) && tokens.next(to)) {
+                blockAllocator->printStatus(from, to);
+            } else {
+                std::cout << "Usage: STAT [SUMMARY | <from> <to> | DUMP <file> [DELTA] [<from> <to>]]\n";
+            }
+        } else if (cmd == "METRICS") {
+            if (cachedAllocator && tokens.next().empty()) {
+                cachedAllocator->blockCache().printCounters(std::cout);
+                continue;
+            }
+            if (!blockAllocator) {
+                std::cout << "METRICS is not supported by the " << engine << " engine.\n";
+                continue;
+            }
+            if (tokens.next() == "PROM") {
+                blockAllocator->writePrometheus(std::cout);
+                continue;
+            }
+            MemoryAllocator::Stats stats = blockAllocator->stats();
+            std::cout << "used_units=" << stats.usedUnits << " free_units=" << stats.freeUnits
+                      << " used_blocks=" << stats.usedBlocks << " free_blocks=" << stats.freeBlocks
+                      << " largest_free=" << stats.largestFree << " fragmentation=" << std::fixed
+                      << std::setprecision(4) << stats.externalFragmentation << " splits=" << stats.splits
+                      << " merges=" << stats.merges << " merges_avoided=" << stats.mergesAvoided << " compactions=" << stats.compactions
+                      << " relocated=" << stats.blocksRelocated << "\nfree_histogram";
+            for (int cls = 0; cls < MemoryAllocator::kSizeClasses; ++cls) {
+                if (stats.freeBlocksByClass[cls])
+                    std::cout << " " << (1LL << cls) << ":" << stats.freeBlocksByClass[cls];
+            }
+            std::cout << "\n";
+        } else if (cmd == "CLASSES") {
+            if (blockAllocator) blockAllocator->printSizeClassStats();
+            else std::cout << "CLASSES is not supported by the " << engine << " engine.\n";
         } else {
-            std::cout << "Unknown command. Available: RQ, RL, C, STAT, X\n";
+            std::cout << "Unknown command. Available: RQ, RL, RESIZE, QUOTA, BATCH, C, POLICY, STAT, CLASSES, "
+                         "METRICS, SAVE, LOAD, NODE, DISTANCE, X\n";
         }
     }
 
 }
+#endif  // ALLOCATOR_FUZZ